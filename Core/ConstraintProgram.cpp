@@ -0,0 +1,342 @@
+#include "ConstraintProgram.h"
+
+#include <cmath>
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+   inline void apply( const RigidTransform& t, const XYZ& p, double& x, double& y, double& z )
+   {
+      x = t.rot[0] * p.x + t.rot[1] * p.y + t.rot[2] * p.z + t.trans.x;
+      y = t.rot[3] * p.x + t.rot[4] * p.y + t.rot[5] * p.z + t.trans.y;
+      z = t.rot[6] * p.x + t.rot[7] * p.y + t.rot[8] * p.z + t.trans.z;
+   }
+   inline void addRotated( const RigidTransform& t, double x, double y, double z, XYZ& out )
+   {
+      out.x += t.rot[0] * x + t.rot[1] * y + t.rot[2] * z;
+      out.y += t.rot[3] * x + t.rot[4] * y + t.rot[5] * z;
+      out.z += t.rot[6] * x + t.rot[7] * y + t.rot[8] * z;
+   }
+}
+
+void ConstraintProgram::clear()
+{
+   _A.clear();
+   _B.clear();
+   _SectorA.clear();
+   _SectorB.clear();
+   _Flags.clear();
+   _SectorIds.clear();
+   _Forward.clear();
+   _InverseRot.clear();
+   _SectorSlotOfId.clear();
+   _SectorSlotOfSparseId.clear();
+   _ColorOrder.clear();
+   _ColorStart.clear();
+   _ColorMovable.clear();
+}
+
+int ConstraintProgram::sectorSlot( const SectorId& sectorId )
+{
+   // bounded ids are looked up in `_SectorSlotOfId`, unbounded ones (e.g. `GraphSymmetry_Lattice`) in the hash map
+   int& slot = sectorId.id() < (int)_SectorSlotOfId.size() ? _SectorSlotOfId[sectorId.id()] : _SectorSlotOfSparseId.emplace( sectorId.id(), -1 ).first->second;
+   if ( slot < 0 )
+   {
+      slot = (int) _SectorIds.size();
+      _SectorIds.push_back( sectorId.id() );
+      _Forward.push_back( sectorId.transform() );
+      _InverseRot.push_back( sectorId.inverseTransform() );
+   }
+   return slot;
+}
+
+void ConstraintProgram::compile( const TileGraph& graph, const std::vector<TileGraph::KeepCloseFar>& keepCloseFars )
+{
+   clear();
+   int maxSectorId = graph._GraphSymmetry->maxSectorId();
+   _SectorSlotOfId.assign( maxSectorId < INT_MAX ? maxSectorId + 1 : 0, -1 );
+
+   for ( const TileGraph::KeepCloseFar& kcf : keepCloseFars )
+   {
+      _A.push_back( kcf.a.index );
+      _B.push_back( kcf.b.index );
+      _SectorA.push_back( sectorSlot( SectorId( kcf.a.sectorId, graph._GraphSymmetry.get() ) ) );
+      _SectorB.push_back( sectorSlot( SectorId( kcf.b.sectorId, graph._GraphSymmetry.get() ) ) );
+      _Flags.push_back( ( kcf.keepClose ? KEEP_CLOSE : 0 ) | ( kcf.keepFar ? KEEP_FAR : 0 ) );
+   }
+
+   resizeScratch();
+}
+
+void ConstraintProgram::resizeScratch()
+{
+   int n = size();
+   _Dx.resize( n );
+   _Dy.resize( n );
+   _Dz.resize( n );
+   _Coef.resize( n );
+   _Error.resize( n );
+   _PaddingError.resize( n );
+   _Energy.resize( n );
+}
+
+void ConstraintProgram::selectActive( const std::vector<XYZ>& pos, double padding, double skin, ConstraintProgram& out )
+{
+   out.clear();
+   out._SectorIds = _SectorIds;
+   out._Forward = _Forward;
+   out._InverseRot = _InverseRot;
+
+   gather( 0, size(), pos );
+   for ( int k = 0; k < size(); k++ )
+   {
+      bool keepClose = ( _Flags[k] & KEEP_CLOSE ) != 0;
+      bool keepFar = ( _Flags[k] & KEEP_FAR ) != 0;
+      double dist2 = _Dx[k]*_Dx[k] + _Dy[k]*_Dy[k] + _Dz[k]*_Dz[k];
+      if ( keepClose && !keepFar && dist2 < ( 1-padding-skin ) * ( 1-padding-skin ) && 1-padding-skin > 0 )
+         continue;
+      if ( keepFar && !keepClose && dist2 > ( 1+padding+skin ) * ( 1+padding+skin ) )
+         continue;
+      out._A.push_back( _A[k] );
+      out._B.push_back( _B[k] );
+      out._SectorA.push_back( _SectorA[k] );
+      out._SectorB.push_back( _SectorB[k] );
+      out._Flags.push_back( _Flags[k] );
+   }
+   out.resizeScratch();
+}
+
+void ConstraintProgram::gather( int begin, int end, const std::vector<XYZ>& pos )
+{
+   double* dx = _Dx.data();
+   double* dy = _Dy.data();
+   double* dz = _Dz.data();
+   for ( int k = begin; k < end; k++ )
+   {
+      double ax, ay, az, bx, by, bz;
+      apply( _Forward[_SectorA[k]], pos[_A[k]], ax, ay, az );
+      apply( _Forward[_SectorB[k]], pos[_B[k]], bx, by, bz );
+      dx[k] = bx - ax;
+      dy[k] = by - ay;
+      dz[k] = bz - az;
+   }
+}
+
+double ConstraintProgram::scatter( int begin, int end, std::vector<XYZ>& out, double& paddingError ) const
+{
+   double totalError = 0;
+   for ( int k = begin; k < end; k++ ) if ( _Coef[k] != 0 )
+   {
+      totalError += _Error[k];
+      paddingError += _PaddingError[k];
+      double fx = _Dx[k] * _Coef[k];
+      double fy = _Dy[k] * _Coef[k];
+      double fz = _Dz[k] * _Coef[k];
+      addRotated( _InverseRot[_SectorA[k]],  fx,  fy,  fz, out[_A[k]] );
+      addRotated( _InverseRot[_SectorB[k]], -fx, -fy, -fz, out[_B[k]] );
+   }
+   return totalError;
+}
+
+double ConstraintProgram::accumulate( int begin, int end, const std::vector<XYZ>& pos, double padding, double gain, std::vector<XYZ>& vel, double& paddingError )
+{
+   // gather:  d = b - a  (world space)
+   gather( begin, end, pos );
+
+   // evaluate:  branch-free, so the compiler can vectorize it
+   // the velocity of `a` is `d * coef`, the velocity of `b` is `-d * coef`
+   const double* dx = _Dx.data();
+   const double* dy = _Dy.data();
+   const double* dz = _Dz.data();
+   const uint8_t* flags = _Flags.data();
+   double* coef = _Coef.data();
+   double* error = _Error.data();
+   double* padError = _PaddingError.data();
+   for ( int k = begin; k < end; k++ )
+   {
+      bool keepClose = ( flags[k] & KEEP_CLOSE ) != 0;
+      bool keepFar = ( flags[k] & KEEP_FAR ) != 0;
+      double pad = keepClose && keepFar ? 0 : padding;
+      double lo = 1. - pad;
+      double hi = 1. + pad;
+      double dist2 = dx[k]*dx[k] + dy[k]*dy[k] + dz[k]*dz[k];
+      bool isClose = keepClose && dist2 >= lo*lo;
+      bool isFar = keepFar && dist2 <= hi*hi;
+      double dist = isClose || isFar ? sqrt( dist2 ) : 1.;
+      double c = 0;
+      double err = 0;
+      double padErr = 0;
+      if ( isClose ) { c += (dist-lo) * gain;        err += std::max( 0., dist-1 ); padErr += dist-lo; }
+      if ( isFar )   { c -= (hi-dist) / dist * gain; err += std::max( 0., 1-dist ); padErr += hi-dist; }
+      coef[k] = c;
+      error[k] = err;
+      padError[k] = padErr;
+   }
+
+   // scatter:  rotate back into each vertex's base frame
+   return scatter( begin, end, vel, paddingError );
+}
+
+double ConstraintProgram::energy( int begin, int end, const std::vector<XYZ>& pos, double padding, std::vector<XYZ>& grad, double& totalError, double& paddingError )
+{
+   gather( begin, end, pos );
+
+   // per constraint:  E = h*h/2  with  h = dist-lo (keepClose) or hi-dist (keepFar)
+   // dE/da = d * coef,  dE/db = -d * coef
+   const double* dx = _Dx.data();
+   const double* dy = _Dy.data();
+   const double* dz = _Dz.data();
+   const uint8_t* flags = _Flags.data();
+   double* coef = _Coef.data();
+   double* error = _Error.data();
+   double* padError = _PaddingError.data();
+   double* energy = _Energy.data();
+   for ( int k = begin; k < end; k++ )
+   {
+      bool keepClose = ( flags[k] & KEEP_CLOSE ) != 0;
+      bool keepFar = ( flags[k] & KEEP_FAR ) != 0;
+      double pad = keepClose && keepFar ? 0 : padding;
+      double lo = 1. - pad;
+      double hi = 1. + pad;
+      double dist2 = dx[k]*dx[k] + dy[k]*dy[k] + dz[k]*dz[k];
+      bool isClose = keepClose && dist2 >= lo*lo;
+      bool isFar = keepFar && dist2 <= hi*hi;
+      double dist = isClose || isFar ? sqrt( dist2 ) : 1.;
+      double hClose = isClose ? dist-lo : 0.;
+      double hFar = isFar ? hi-dist : 0.;
+      coef[k] = ( hFar - hClose ) / dist;
+      energy[k] = ( hClose*hClose + hFar*hFar ) * .5;
+      error[k] = ( isClose ? std::max( 0., dist-1 ) : 0. ) + ( isFar ? std::max( 0., 1-dist ) : 0. );
+      padError[k] = hClose + hFar;
+   }
+
+   double ret = 0;
+   for ( int k = begin; k < end; k++ )
+      ret += energy[k];
+
+   totalError += scatter( begin, end, grad, paddingError );
+   return ret;
+}
+
+void ConstraintProgram::colorize( const std::vector<bool>& movable )
+{
+   _ColorMovable = movable;
+
+   // greedy:  each constraint takes the first color not used yet by either of its movable ends
+   std::vector<std::vector<bool>> usedColors( movable.size() );
+   auto isUsed = [&]( int vertex, int color ) { return movable[vertex] && color < (int) usedColors[vertex].size() && usedColors[vertex][color]; };
+   auto use = [&]( int vertex, int color ) {
+      if ( !movable[vertex] )
+         return;
+      if ( color >= (int) usedColors[vertex].size() )
+         usedColors[vertex].resize( color+1 );
+      usedColors[vertex][color] = true;
+   };
+
+   std::vector<int> colorOf( size() );
+   int numColors = 1;
+   for ( int k = 0; k < size(); k++ )
+   {
+      int color = 0;
+      while ( isUsed( _A[k], color ) || isUsed( _B[k], color ) )
+         color++;
+      use( _A[k], color );
+      use( _B[k], color );
+      colorOf[k] = color;
+      numColors = std::max( numColors, color+1 );
+   }
+
+   // counting sort by color, stable so each class keeps the constraint order
+   _ColorStart.assign( numColors+1, 0 );
+   for ( int color : colorOf )
+      _ColorStart[color+1]++;
+   for ( int c = 0; c < numColors; c++ )
+      _ColorStart[c+1] += _ColorStart[c];
+   _ColorOrder.resize( size() );
+   std::vector<int> next( _ColorStart.begin(), _ColorStart.end()-1 );
+   for ( int k = 0; k < size(); k++ )
+      _ColorOrder[next[colorOf[k]]++] = k;
+}
+
+double ConstraintProgram::project( int begin, int end, std::vector<XYZ>& pos, double padding, const IGraphShape& graphShape, double& paddingError ) const
+{
+   double totalError = 0;
+   visitShape( graphShape, [&]( const auto& shape ) {
+      for ( int i = begin; i < end; i++ )
+      {
+         int k = _ColorOrder[i];
+         bool keepClose = ( _Flags[k] & KEEP_CLOSE ) != 0;
+         bool keepFar = ( _Flags[k] & KEEP_FAR ) != 0;
+         double pad = keepClose && keepFar ? 0 : padding;
+         double lo = 1. - pad;
+         double hi = 1. + pad;
+         double ax, ay, az, bx, by, bz;
+         apply( _Forward[_SectorA[k]], pos[_A[k]], ax, ay, az );
+         apply( _Forward[_SectorB[k]], pos[_B[k]], bx, by, bz );
+         double dx = bx - ax, dy = by - ay, dz = bz - az;
+         double dist2 = dx*dx + dy*dy + dz*dz;
+         bool isClose = keepClose && dist2 > lo*lo;
+         bool isFar = keepFar && dist2 < hi*hi;
+         if ( !isClose && !isFar )
+            continue;
+
+         double dist = sqrt( dist2 );
+         if ( isClose ) { totalError += std::max( 0., dist-1 ); paddingError += dist-lo; }
+         if ( isFar )   { totalError += std::max( 0., 1-dist ); paddingError += hi-dist; }
+         if ( !_ColorMovable[_A[k]] && !_ColorMovable[_B[k]] )
+            continue;
+
+         // C = dist - target,  move each movable end by  -C * grad / sum|grad|^2
+         double c = dist - ( isClose ? lo : hi );
+         XYZ gradA, gradB;
+         addRotated( _InverseRot[_SectorA[k]], -dx/dist, -dy/dist, -dz/dist, gradA );
+         addRotated( _InverseRot[_SectorB[k]],  dx/dist,  dy/dist,  dz/dist, gradB );
+         if ( _A[k] == _B[k] )
+         {
+            XYZ grad = gradA + gradB;
+            double w = grad.len2();
+            if ( w > 0 )
+               pos[_A[k]] = shape.toSurfaceFrom3D( pos[_A[k]] - grad * ( c / w ) );
+            continue;
+         }
+         double w = ( _ColorMovable[_A[k]] ? gradA.len2() : 0. ) + ( _ColorMovable[_B[k]] ? gradB.len2() : 0. );
+         if ( _ColorMovable[_A[k]] )
+            pos[_A[k]] = shape.toSurfaceFrom3D( pos[_A[k]] - gradA * ( c / w ) );
+         if ( _ColorMovable[_B[k]] )
+            pos[_B[k]] = shape.toSurfaceFrom3D( pos[_B[k]] - gradB * ( c / w ) );
+      }
+   } );
+   return totalError;
+}
+
+void ConstraintProgram::linearize( int begin, int end, const std::vector<XYZ>& pos, double padding, std::vector<Linearization>& out )
+{
+   gather( begin, end, pos );
+
+   for ( int k = begin; k < end; k++ )
+   {
+      Linearization& lin = out[k];
+      bool keepClose = ( _Flags[k] & KEEP_CLOSE ) != 0;
+      bool keepFar = ( _Flags[k] & KEEP_FAR ) != 0;
+      double pad = keepClose && keepFar ? 0 : padding;
+      double lo = 1. - pad;
+      double hi = 1. + pad;
+      double dist2 = _Dx[k]*_Dx[k] + _Dy[k]*_Dy[k] + _Dz[k]*_Dz[k];
+      bool isClose = keepClose && dist2 >= lo*lo;
+      bool isFar = keepFar && dist2 <= hi*hi;
+      lin.numActive = ( isClose ? 1 : 0 ) + ( isFar ? 1 : 0 );
+      if ( lin.numActive == 0 )
+         continue;
+
+      double dist = sqrt( dist2 );
+      lin.residual = ( isClose ? dist-lo : 0. ) + ( isFar ? dist-hi : 0. );
+      double ux = _Dx[k] / dist;
+      double uy = _Dy[k] / dist;
+      double uz = _Dz[k] / dist;
+      lin.gradA = XYZ();
+      lin.gradB = XYZ();
+      addRotated( _InverseRot[_SectorA[k]], -ux, -uy, -uz, lin.gradA );
+      addRotated( _InverseRot[_SectorB[k]],  ux,  uy,  uz, lin.gradB );
+   }
+}
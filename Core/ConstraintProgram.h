@@ -0,0 +1,92 @@
+#pragma once
+
+#include "CoreMacros.h"
+#include "DataTypes.h"
+#include "TileGraph.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// `TileGraph::KeepCloseFar` constraints compiled into flat arrays, so that the per-step loop
+// only touches ints and doubles (no VertexPtr/SectorId chasing, no virtual calls, no matrix inversion)
+class ConstraintProgram
+{
+public:
+   enum Flags : uint8_t { KEEP_CLOSE = 1, KEEP_FAR = 2 };
+
+   // first-order model of one constraint:  `numActive` hinges, each with residual dist-lo or dist-hi
+   // (the energy of the constraint is the sum of the squared residuals over 2)
+   struct Linearization
+   {
+      int numActive;
+      double residual; // sum of the active residuals
+      XYZ gradA;       // gradient of the distance w.r.t. `a`, in the base frame of `a`
+      XYZ gradB;
+   };
+
+   CORE_API void compile( const TileGraph& graph, const std::vector<TileGraph::KeepCloseFar>& keepCloseFars );
+   CORE_API void clear();
+   // copies into `out` the constraints that are within `skin` of their band at `pos` (rigid ones always), with their sector tables
+   // while no vertex has moved more than skin/2 since, the others are inactive (sector transforms are isometries)
+   CORE_API void selectActive( const std::vector<XYZ>& pos, double padding, double skin, ConstraintProgram& out );
+   CORE_API int size() const { return (int) _A.size(); }
+
+   // adds each active constraint's velocity (in the base frame of the vertex) to `vel`
+   // `pos` = base vertex positions, returns total error
+   CORE_API double accumulate( const std::vector<XYZ>& pos, double padding, double gain, std::vector<XYZ>& vel, double& paddingError ) { return accumulate( 0, size(), pos, padding, gain, vel, paddingError ); }
+   // same, for constraints [begin,end) only.  disjoint ranges may run concurrently (with separate `vel` buffers)
+   CORE_API double accumulate( int begin, int end, const std::vector<XYZ>& pos, double padding, double gain, std::vector<XYZ>& vel, double& paddingError );
+
+   // penalty energy sum(h*h/2), with h = how far the distance is outside the allowed band
+   // adds the gradient (in the base frame of each vertex) to `grad`, and the same errors as `accumulate`
+   CORE_API double energy( int begin, int end, const std::vector<XYZ>& pos, double padding, std::vector<XYZ>& grad, double& totalError, double& paddingError );
+
+   // partitions the constraints into color classes whose constraints share no movable vertex,
+   // so the constraints of one class can be projected concurrently
+   CORE_API void colorize( const std::vector<bool>& movable );
+   CORE_API bool isColorized( const std::vector<bool>& movable ) const { return !_ColorStart.empty() && movable == _ColorMovable; }
+   CORE_API int numColors() const { return (int) _ColorStart.size() - 1; }
+
+   // moves the ends of constraints _ColorOrder[begin,end) onto their distance band, one after the other (Gauss-Seidel)
+   // `pos` = base vertex positions, updated in place and kept on `shape`.  returns the total error before each projection
+   CORE_API double project( int begin, int end, std::vector<XYZ>& pos, double padding, const IGraphShape& shape, double& paddingError ) const;
+
+   // linearizes constraints [begin,end) at `pos` into `out[begin,end)`
+   CORE_API void linearize( int begin, int end, const std::vector<XYZ>& pos, double padding, std::vector<Linearization>& out );
+
+private:
+   int sectorSlot( const SectorId& sectorId );
+   void resizeScratch();
+   void gather( int begin, int end, const std::vector<XYZ>& pos );
+   double scatter( int begin, int end, std::vector<XYZ>& out, double& paddingError ) const;
+
+public:
+   // per constraint
+   std::vector<int>     _A;
+   std::vector<int>     _B;
+   std::vector<int>     _SectorA;   // index into `_Forward` / `_InverseRot`
+   std::vector<int>     _SectorB;
+   std::vector<uint8_t> _Flags;
+
+   // per sector referenced by any constraint
+   std::vector<int>       _SectorIds;
+   std::vector<RigidTransform> _Forward;
+   std::vector<RigidTransform> _InverseRot; // inverted sector transform, only its rotation is used
+
+   // constraint indices grouped by color, color c is _ColorOrder[_ColorStart[c],_ColorStart[c+1])
+   std::vector<int> _ColorOrder;
+   std::vector<int> _ColorStart;
+
+private:
+   std::vector<bool>   _ColorMovable;
+
+private: // scratch
+   std::vector<int>    _SectorSlotOfId;
+   std::unordered_map<int, int> _SectorSlotOfSparseId;
+   std::vector<double> _Dx, _Dy, _Dz;
+   std::vector<double> _Coef;
+   std::vector<double> _Error;
+   std::vector<double> _PaddingError;
+   std::vector<double> _Energy;
+};
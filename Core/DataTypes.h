@@ -3,8 +3,14 @@
 #include "CoreMacros.h"
 #include "Json.h"
 #include <cmath>
+#include <cstdint>
 #include <vector>
 
+#if defined(__SSSE3__) || ( defined(_MSC_VER) && ( defined(_M_X64) || defined(_M_IX86) ) )
+#include <tmmintrin.h>
+#define PERM_SHUFFLE
+#endif
+
 #define PI 3.14159265359
 
 class CORE_API XYZ
@@ -129,52 +135,92 @@ public:
    XYZW m[4];
 };
 
-class Perm
+// isometry  p -> rot * p + trans  (rot is row-major and orthonormal), so the inverse is a transpose
+class CORE_API RigidTransform
+{
+public:
+   RigidTransform() : rot { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, trans( 0, 0, 0 ) {}
+   explicit RigidTransform( const Matrix4x4& m ) : trans( m( 0, 3 ), m( 1, 3 ), m( 2, 3 ) ) { for ( int r = 0; r < 3; r++ ) for ( int c = 0; c < 3; c++ ) rot[r*3+c] = m( r, c ); }
+
+   XYZ rotate( const XYZ& v ) const { return XYZ( rot[0] * v.x + rot[1] * v.y + rot[2] * v.z, rot[3] * v.x + rot[4] * v.y + rot[5] * v.z, rot[6] * v.x + rot[7] * v.y + rot[8] * v.z ); }
+   XYZ operator*( const XYZ& p ) const { return rotate( p ) + trans; }
+   RigidTransform operator*( const RigidTransform& rhs ) const
+   {
+      RigidTransform ret;
+      for ( int r = 0; r < 3; r++ )
+      for ( int c = 0; c < 3; c++ )
+         ret.rot[r*3+c] = rot[r*3] * rhs.rot[c] + rot[r*3+1] * rhs.rot[3+c] + rot[r*3+2] * rhs.rot[6+c];
+      ret.trans = *this * rhs.trans;
+      return ret;
+   }
+   RigidTransform inverted() const
+   {
+      RigidTransform ret;
+      for ( int r = 0; r < 3; r++ )
+      for ( int c = 0; c < 3; c++ )
+         ret.rot[r*3+c] = rot[c*3+r];
+      ret.trans = -ret.rotate( trans );
+      return ret;
+   }
+   Matrix4x4 toMatrix() const { return Matrix4x4( rot[0], rot[1], rot[2], trans.x, rot[3], rot[4], rot[5], trans.y, rot[6], rot[7], rot[8], trans.z, 0, 0, 0, 1 ); }
+
+public:
+   double rot[9];
+   XYZ trans;
+};
+
+// permutation of the colors [0,MAX_SIZE), colors past `size()` map to themselves.  Fixed size and allocation free:
+// 15 map entries and the size in one 16-byte vector, so composition is a single byte shuffle
+class alignas(16) Perm
 {
 public:
-   Perm() {}
-   Perm( int n ) { for ( int i = 0; i < n; i++ ) v.push_back( i ); }
-   Perm( const std::initializer_list<int>& w ) : v(w.begin(), w.end()) {}
-   Perm( const Json& json ) { for( const Json& j : json.toArray() ) v.push_back( j.toInt() ); }
+   static const int MAX_SIZE = 15;
+
+   Perm() { for ( int i = 0; i < MAX_SIZE; i++ ) v[i] = (uint8_t) i; v[MAX_SIZE] = 0; }
+   Perm( int n ) : Perm() { if ( n > MAX_SIZE ) throw 777; v[MAX_SIZE] = (uint8_t) n; }
+   Perm( const std::initializer_list<int>& w ) : Perm( (int) w.size() ) { int i = 0; for ( int x : w ) set( i++, x ); }
+   Perm( const Json& json ) : Perm( (int) json.toArray().size() ) { int i = 0; for( const Json& j : json.toArray() ) set( i++, j.toInt() ); }
 
-   bool isIdentity() const { return *this == Perm( (int) v.size() ); }
-   int operator[]( int idx ) const { if ( idx >= (int) v.size() ) return idx; return v[idx]; }
-   //int& operator[]( int idx ) { if ( idx >= v.size() ) return idx; return v[idx]; }
+   int size() const { return v[MAX_SIZE]; }
+   bool isIdentity() const { for ( int i = 0; i < size(); i++ ) if ( v[i] != i ) return false; return true; }
+   int operator[]( int idx ) const { if ( idx < 0 || idx >= MAX_SIZE ) return idx; return v[idx]; }
 
    bool operator==( const Perm& rhs ) const
    {
-      if ( v.size() != rhs.v.size() )
-         return false;
-      for ( int i = 0; i < (int) v.size(); i++ )
+      for ( int i = 0; i <= MAX_SIZE; i++ )
          if ( v[i] != rhs.v[i] )
             return false;
       return true;
    }
+   // (a*b)[i] = b[a[i]]
    Perm operator*( const Perm& rhs ) const
    {
-      if ( rhs.v.empty() )
-         return *this;
-      if ( v.empty() )
-         return rhs;
-
       Perm ret;
-      for ( int i = 0; i < (int) v.size(); i++ )
-         ret.v.push_back( rhs[v[i]] );
+#ifdef PERM_SHUFFLE
+      _mm_store_si128( (__m128i*) ret.v, _mm_shuffle_epi8( _mm_load_si128( (const __m128i*) rhs.v ), _mm_load_si128( (const __m128i*) v ) ) );
+#else
+      for ( int i = 0; i < MAX_SIZE; i++ )
+         ret.v[i] = rhs.v[v[i]];
+#endif
+      ret.v[MAX_SIZE] = v[MAX_SIZE] > rhs.v[MAX_SIZE] ? v[MAX_SIZE] : rhs.v[MAX_SIZE];
       return ret;
    }
    Perm inverted() const
    {
-      Perm ret( v.size() );
-      for ( int i = 0; i < (int) v.size(); i++ )
-         ret.v[v[i]] = i;
+      Perm ret;
+      for ( int i = 0; i < MAX_SIZE; i++ )
+         ret.v[v[i]] = (uint8_t) i;
+      ret.v[MAX_SIZE] = v[MAX_SIZE];
       return ret;
    }
    Perm pow( int n ) const
    {
-      Perm ret( v.size() );
-      for ( int i = 0; i < abs( n ); i++ )
-         ret = *this * ret;
-      return n >= 0 ? ret : ret.inverted();
+      Perm ret = Perm( size() );
+      Perm base = n >= 0 ? *this : inverted();
+      for ( unsigned e = n >= 0 ? (unsigned) n : 0u - (unsigned) n; e; e >>= 1, base = base * base )
+         if ( e & 1 )
+            ret = ret * base;
+      return ret;
    }
    //bool circularlyMatches( const Perm& rhs ) const
    //{
@@ -185,8 +231,21 @@ public:
    //   return true;
    //}
 
-   Json toJson() const { return Json( v ); }
+   Json toJson() const { return Json( std::vector<int>( v, v + size() ) ); }
+
+private:
+   void set( int idx, int x ) { if ( x < 0 || x >= size() ) throw 777; v[idx] = (uint8_t) x; }
 
 public:
-   std::vector<int> v;
-};
\ No newline at end of file
+   uint8_t v[MAX_SIZE+1]; // v[MAX_SIZE] = size
+};
+
+// (index, sector id) of a vertex or tile;  what the graphs store internally, the graph itself is known from context
+struct GraphHandle
+{
+   int32_t index = -1;
+   int32_t sectorId = -1;
+
+   bool operator==( const GraphHandle& rhs ) const { return index == rhs.index && sectorId == rhs.sectorId; }
+   bool operator!=( const GraphHandle& rhs ) const { return !(*this == rhs); }
+};
@@ -1,5 +1,21 @@
 #pragma once
 
-static const int MAX_VERTICES = 1000;
+#include <cstdint>
+#include <climits>
+
 static const int BLANK_COLOR = 9;
 static const int MAX_COLORS = 9;
+
+// ids are `stride * sectorId + index`.  The stride is a power of ten, at least 1000, so graphs up to 1000 vertices keep their readable ids.
+// A graph keeps its stride while vertices come and go, so ids only change if it outgrows it
+inline int64_t idStride( int numVertices ) { int64_t ret = 1000; while ( ret < numVertices ) ret *= 10; return ret; }
+
+// the inverse;  false if `id` can't be one
+inline bool decodeId( int64_t id, int64_t stride, int numVertices, int& index, int& sectorId )
+{
+   if ( id < 0 || id / stride > INT_MAX || id % stride >= numVertices )
+      return false;
+   index = (int) ( id % stride );
+   sectorId = (int) ( id / stride );
+   return true;
+}
@@ -62,24 +62,22 @@ DualAnalysis::DualAnalysis( const DualGraph& dual )
 void DualAnalysis::init( const DualGraph& dual )
 {
    for ( const DualGraph::VertexPtr& a : dual.rawVertices() )
-   for ( const DualGraph::VertexPtr& b : a.neighbors() )
+   for ( const DualGraph::VertexPtr& b : a.neighborRange() )
       if ( a.color() == b.color() && a.color() != BLANK_COLOR )
          return setError( "neighbors " + a + " and " + b + " are the same color", { a, b } );
 
    for ( const DualGraph::VertexPtr& a : dual.rawVertices() )
-   for ( const DualGraph::VertexPtr& b : a.neighbors() )
-   for ( const DualGraph::VertexPtr& c : a.neighbors() ) if ( b.id() < c.id() )
+   for ( const DualGraph::VertexPtr& b : a.neighborRange() )
+   for ( const DualGraph::VertexPtr& c : a.neighborRange() ) if ( b.id() < c.id() )
       if ( c.color() == b.color() && c.color() != BLANK_COLOR )
          return setError( b + " and " + c + " share a neighbor and are the same color", { b, c } );
 
 
    for ( const DualGraph::VertexPtr& a : dual.rawVertices() )
-   for ( const DualGraph::VertexPtr& b : a.neighbors() ) if ( a.id() < b.id() )
+   for ( const DualGraph::VertexPtr& b : a.neighborRange() ) if ( a.id() < b.id() )
    {
       DualGraph::VertexPtr diag;
 
-      auto diagsA = a.diagonals();
-      auto diagsB = b.diagonals();
       int direction = -1;
 
       for ( int i = 0; i < 2; i++ )
@@ -143,7 +141,7 @@ bool DualAnalysis::isCurved( const DualGraph::VertexPtr& a_, const DualGraph::Ve
    DualGraph::VertexPtr a = a_.premul( a_.sectorId().inverted() );
    DualGraph::VertexPtr b = b_.premul( a_.sectorId().inverted() );
 
-   std::pair<int,int> pr( a.id(), b.id() );
+   std::pair<int64_t,int64_t> pr( a.id(), b.id() );
    if ( pr.first > pr.second )
       std::swap( pr.first, pr.second );
    return _CurveDirectionForEdge.count( pr ) > 0;
@@ -154,7 +152,7 @@ bool DualAnalysis::isCurvedTowardsA( const DualGraph::VertexPtr& a_, const DualG
    DualGraph::VertexPtr a = a_.premul( a_.sectorId().inverted() );
    DualGraph::VertexPtr b = b_.premul( a_.sectorId().inverted() );
 
-   std::pair<int,int> pr( a.id(), b.id() );
+   std::pair<int64_t,int64_t> pr( a.id(), b.id() );
    bool swappedAB = pr.first > pr.second;
    if ( swappedAB )
       std::swap( pr.first, pr.second );
@@ -28,7 +28,7 @@ private:
    std::vector<DualGraph::VertexPtr> _ErrorVertices;
 
 private:
-   std::map<std::pair<int,int>, bool> _CurveDirectionForEdge;
+   std::map<std::pair<int64_t,int64_t>, bool> _CurveDirectionForEdge;
 
 private:
    bool _IsValid = false;
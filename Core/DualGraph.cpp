@@ -2,6 +2,8 @@
 #include "GraphUtil.h"
 #include "trace.h"
 
+#include <cctype>
+
 class SwapNum
 {
 public:
@@ -11,8 +13,16 @@ private:
    int _a, _b;
 };
 
+// reflections turn counter-clockwise into clockwise
+static bool isReflection( const SectorId& sector )
+{
+   RigidTransform t = sector.transform();
+   const double* r = t.rot;
+   return r[0] * ( r[4] * r[8] - r[5] * r[7] ) - r[1] * ( r[3] * r[8] - r[5] * r[6] ) + r[2] * ( r[3] * r[7] - r[4] * r[6] ) < 0;
+}
+
 const DualGraph::Vertex& DualGraph::VertexPtr::baseVertex() const { return _Graph->_Vertices[_Index]; }
-XYZ DualGraph::VertexPtr::pos() const { return _SectorId.matrix() * baseVertex().pos; };
+XYZ DualGraph::VertexPtr::pos() const { return _SectorId.transform() * baseVertex().pos; };
 int DualGraph::VertexPtr::color() const { return _SectorId.mapColor( baseVertex().color ); }
 std::string DualGraph::VertexPtr::name() const 
 { 
@@ -22,25 +32,12 @@ std::string DualGraph::VertexPtr::name() const
    return std::to_string( id() );
 }
 
-std::vector<DualGraph::VertexPtr> DualGraph::VertexPtr::neighbors() const
-{
-   std::vector<DualGraph::VertexPtr> ret;
-   for ( const DualGraph::VertexPtr& baseNeighb : baseVertex().neighbors )
-   {
-      ret.push_back( baseNeighb.premul( _SectorId ) );
-      //DualGraph::VertexPtr neighb = baseNeighb.premul( _Matrix );
-      //for ( const Matrix4x4& otherSector : baseVertex().symmetry->sector0Equivalents() )
-      //   ret.push_back( neighb.premul( otherSector ) );
-   }
-   return ret;
-}
-
 std::vector<DualGraph::VertexPtr> DualGraph::VertexPtr::diagonals() const
 {
    std::vector<VertexPtr> ret;
-   for ( const DualGraph::VertexPtr& neighb : neighbors() )
+   for ( int i = 0; i < (int)baseVertex().neighbors.size(); i++ )
    {
-      std::vector<DualGraph::VertexPtr> poly = polygon( neighb );
+      std::vector<DualGraph::VertexPtr> poly = polygonAt( i );
       if ( poly.size() > 3 && isValidPolygon( _Graph->_GraphShape, poly ) )
          ret.insert( ret.end(), poly.begin() + 3, poly.end() );
    }
@@ -50,9 +47,9 @@ std::vector<DualGraph::VertexPtr> DualGraph::VertexPtr::diagonals() const
 std::vector<std::vector<DualGraph::VertexPtr>> DualGraph::VertexPtr::edgesAndDiagonals() const
 {
    std::vector<std::vector<VertexPtr>> ret;
-   for ( const DualGraph::VertexPtr& neighb : neighbors() )
+   for ( int i = 0; i < (int)baseVertex().neighbors.size(); i++ )
    {
-      std::vector<DualGraph::VertexPtr> poly = polygon( neighb );
+      std::vector<DualGraph::VertexPtr> poly = polygonAt( i );
       if ( poly.size() > 2 && isValidPolygon( _Graph->_GraphShape, poly ) )
          ret.push_back( std::vector<VertexPtr>( poly.begin() + 2, poly.end() ) );
    }
@@ -60,6 +57,38 @@ std::vector<std::vector<DualGraph::VertexPtr>> DualGraph::VertexPtr::edgesAndDia
    return ret;
 }
 
+std::vector<DualGraph::VertexPtr> DualGraph::VertexPtr::polygon( const VertexPtr& a ) const
+{
+   if ( _Graph->hasHalfEdges() )
+   {
+      int slot = baseVertex().neighborIndexOf( a.unpremul( _SectorId ) );
+      return slot == -1 ? std::vector<VertexPtr>() : polygonAt( slot );
+   }
+
+   std::vector<VertexPtr> ret = { a, *this };
+   while ( true )
+   {
+      VertexPtr c = ret.back().next( ret[ret.size()-2] );
+      if ( !c.isValid() )
+         return {};
+      if ( c == ret[0] )
+         return ret;
+      ret.push_back( c );
+   }
+}
+
+std::vector<DualGraph::VertexPtr> DualGraph::VertexPtr::polygonAt( int slot ) const
+{
+   if ( !_Graph->hasHalfEdges() )
+      return polygon( neighborRange()[slot] );
+
+   // the face left of a->b is the face of the twin of b->a
+   const HalfEdge& ba = _Graph->_HalfEdges[_Graph->_FirstHalfEdge[_Index] + slot];
+   if ( ba.twin == -1 )
+      return {};
+   return _Graph->face( ba.twin, _SectorId * SectorId( ba.target.sectorId, _Graph->_GraphSymmetry.get() ) ).toVector();
+}
+
 DualGraph::VertexPtr DualGraph::VertexPtr::premul( const SectorId& mtx ) const
 {
    return withSectorId( mtx * _SectorId );
@@ -80,17 +109,20 @@ DualGraph::DualGraph( std::shared_ptr<IGraphSymmetry> graphSymmetry, std::shared
 void DualGraph::addVertex( int color, const XYZ& pos )
 {
    _Vertices.push_back( Vertex( (int) _Vertices.size(), color, _GraphShape->toSurfaceFrom3D( pos ) ) );
+   _IdStride = std::max( _IdStride, idStride( (int) _Vertices.size() ) );
    _Vertices.back().symmetry = _GraphSymmetry->calcSectorSymmetry( pos );
+   clearHalfEdges();
 }
 
 void DualGraph::swapVertexIndexes( int a, int b )
 {
    std::swap( _Vertices[a], _Vertices[b] );
    std::swap( _Vertices[a].index, _Vertices[b].index );
+   clearHalfEdges();
    SwapNum swapper( a, b );
    for ( Vertex& vtx : _Vertices )
-      for ( VertexPtr& neighb : _Vertices[vtx.index].neighbors )
-         neighb._Index = swapper[neighb._Index];
+      for ( GraphHandle& neighb : _Vertices[vtx.index].neighbors )
+         neighb.index = swapper[neighb.index];
 }
 
 void DualGraph::deleteVertex( const VertexPtr& vtx )
@@ -100,8 +132,8 @@ void DualGraph::deleteVertex( const VertexPtr& vtx )
    int k = (int)_Vertices.size()-1;
    swapVertexIndexes( vtx.index(), k );
 
-   for ( VertexPtr& neighb : _Vertices[k].neighbors )
-      _Vertices[neighb.index()].eraseEdgesTo( k );
+   for ( const GraphHandle& neighb : _Vertices[k].neighbors )
+      _Vertices[neighb.index].eraseEdgesTo( k );
 
    _Vertices.pop_back();
 }
@@ -125,6 +157,27 @@ std::vector<DualGraph::VertexPtr> DualGraph::allVisibleVertices() const
    return ret;
 }
 
+DualGraph::VertexPtr DualGraph::vertexWithId( int64_t id ) const
+{
+   int index, sectorId;
+   if ( !decodeId( id, _IdStride, (int) _Vertices.size(), index, sectorId ) || !_GraphSymmetry->isSectorId( sectorId ) || !_GraphSymmetry->isSectorIdVisible( sectorId ) )
+      return VertexPtr();
+
+   VertexPtr ret( this, index, SectorId( sectorId, _GraphSymmetry.get() ) );
+   if ( ret._SectorId.id() != sectorId ) // not canonical, so some other id names this vertex
+      return VertexPtr();
+   return ret;
+}
+
+DualGraph::VertexPtr DualGraph::vertexWithName( const std::string& name ) const
+{
+   // names are ids in decimal
+   if ( name.empty() || name.size() > 19 || !std::all_of( name.begin(), name.end(), ::isdigit ) )
+      return VertexPtr();
+   VertexPtr ret = vertexWithId( std::stoll( name ) );
+   return ret.isValid() && ret.name() == name ? ret : VertexPtr();
+}
+
 DualGraph::VertexPtr DualGraph::vertexAt( const XYZ& pos, double maxDist ) const
 {
    VertexPtr ret;
@@ -151,10 +204,10 @@ void DualGraph::setVertexColor( const VertexPtr& vtx, int color )
 
 void DualGraph::setVertexPos( const VertexPtr& vtx, const XYZ& pos )
 {
-   _Vertices[vtx._Index].pos = vtx._SectorId.inverted().matrix() * pos;
+   _Vertices[vtx._Index].pos = vtx._SectorId.inverseTransform() * pos;
 }
 
-void DualGraph::toggleEdge( int idA, int idB )
+void DualGraph::toggleEdge( int64_t idA, int64_t idB )
 {
    toggleEdge( vertexWithId( idA ), vertexWithId( idB ) );
 }
@@ -167,6 +220,7 @@ void DualGraph::toggleEdge( const VertexPtr& a, const VertexPtr& b )
    VertexPtr a0 = a.unpremul( b._SectorId );
    VertexPtr b0 = b.unpremul( a._SectorId );
 
+   clearHalfEdges();
    bool hadEdge = _Vertices[a._Index].hasNeighbor( b0 );
    if ( hadEdge )
    {
@@ -193,8 +247,113 @@ void DualGraph::sortNeighbors()
       XYZ n = _GraphShape->normalAt( vtx.pos );
       Matrix4x4 m = matrixRotateToZAxis( n ) * Matrix4x4::translation( -vtx.pos );
       auto angleOf = [&]( const XYZ& p ) { XYZ q = m*p; return ::atan2( q.y, q.x ); };
-      sort( vtx.neighbors.begin(), vtx.neighbors.end(), [&]( const VertexPtr& a, const VertexPtr& b ) { return angleOf( a.pos() ) < angleOf( b.pos() ); } );
+      sort( vtx.neighbors.begin(), vtx.neighbors.end(), [&]( const GraphHandle& a, const GraphHandle& b ) { return angleOf( (*this)[a].pos() ) < angleOf( (*this)[b].pos() ); } );
    }
+   buildHalfEdges();
+}
+
+void DualGraph::buildHalfEdges()
+{
+   clearHalfEdges();
+   for ( const Vertex& vtx : _Vertices )
+   {
+      _FirstHalfEdge.push_back( (int) _HalfEdges.size() );
+      int n = (int) vtx.neighbors.size();
+      for ( int i = 0; i < n; i++ )
+      {
+         HalfEdge h;
+         h.origin = vtx.index;
+         h.target = vtx.neighbors[i];
+         h.rotateNext = (int) _HalfEdges.size() - i + (i+1) % n;
+         _HalfEdges.push_back( h );
+      }
+   }
+   _FirstHalfEdge.push_back( (int) _HalfEdges.size() );
+
+   // twin of a->b@s is the half-edge of b pointing back at a, seen from sector s
+   for ( HalfEdge& h : _HalfEdges )
+   {
+      int slot = _Vertices[h.target.index].neighborIndexOf( (*this)[h.origin].unpremul( (*this)[h.target]._SectorId ) );
+      if ( slot != -1 )
+         h.twin = _FirstHalfEdge[h.target.index] + slot;
+   }
+
+   int mirrorSectorId = -1; // some sector that reverses orientation, -1 if the symmetry has none
+   for ( const SectorId& sector : _GraphSymmetry->allSectors() )
+      if ( isReflection( sector ) )
+      {
+         mirrorSectorId = sector.id();
+         break;
+      }
+
+   // walk each face once per orientation:  across to the twin, then one step counter-clockwise (as seen in the sector the twin is in).
+   // the half-edges met on the way share the face, each rotated to start at its origin and seen from its own sector
+   int maxFaceSize = (int) _HalfEdges.size() * std::max( 1, _GraphSymmetry->numSectors() ) + 2;
+   std::vector<GraphHandle> face;
+   std::vector<std::pair<int, SectorId>> faceEdges; // half-edge at each position of `face`, and the sector it's in
+   for ( int mirrored = 0; mirrored < ( mirrorSectorId == -1 ? 1 : 2 ); mirrored++ )
+   {
+      SectorId start( mirrored ? mirrorSectorId : 0, _GraphSymmetry.get() );
+      for ( int i = 0; i < (int)_HalfEdges.size(); i++ )
+      {
+         const HalfEdge& h = _HalfEdges[i];
+         if ( h.face[mirrored].begin != -1 )
+            continue;
+
+         face = { (*this)[h.origin].premul( start ).handle(), (*this)[h.target].premul( start ).handle() };
+         faceEdges = { { i, start } };
+         int cur = h.twin;
+         SectorId sector = start * (*this)[h.target]._SectorId;
+         bool isClosed = false;
+         while ( cur != -1 && (int)face.size() <= maxFaceSize )
+         {
+            int aroundIndex = _HalfEdges[cur].rotateNext;
+            if ( mirrorSectorId != -1 && isReflection( sector ) )
+            {
+               int first = _FirstHalfEdge[_HalfEdges[cur].origin];
+               int n = _FirstHalfEdge[_HalfEdges[cur].origin+1] - first;
+               aroundIndex = first + ( cur - first + n - 1 ) % n;
+            }
+            const HalfEdge& around = _HalfEdges[aroundIndex];
+            VertexPtr c = (*this)[around.target].premul( sector );
+            if ( !c.isValid() )
+               break;
+            faceEdges.push_back( { aroundIndex, sector } );
+            if ( c.handle() == face[0] )
+            {
+               isClosed = true;
+               break;
+            }
+            face.push_back( c.handle() );
+            sector = sector * (*this)[around.target]._SectorId;
+            cur = around.twin;
+         }
+         if ( !isClosed )
+            continue;
+
+         int begin = (int) _FaceVertices.size();
+         _FaceVertices.insert( _FaceVertices.end(), face.begin(), face.end() );
+         _FaceVertices.insert( _FaceVertices.end(), face.begin(), face.end() );
+         for ( int k = 0; k < (int)faceEdges.size(); k++ )
+         {
+            FaceSpan& span = _HalfEdges[faceEdges[k].first].face[mirrorSectorId != -1 && isReflection( faceEdges[k].second )];
+            if ( span.begin != -1 ) // met again in another sector, around a center of rotation
+               continue;
+            span.begin = begin + k;
+            span.size = (int) face.size();
+            span.sector = faceEdges[k].second.inverted().id();
+         }
+      }
+   }
+}
+
+SectorRange<DualGraph::VertexPtr, DualGraph> DualGraph::face( int halfEdge, const SectorId& sector ) const
+{
+   if ( !hasHalfEdges() )
+      throw 777;
+   const FaceSpan& span = _HalfEdges[halfEdge].face[isReflection( sector )];
+   const GraphHandle* first = _FaceVertices.data() + std::max( 0, span.begin );
+   return SectorRange<VertexPtr, DualGraph>( this, first, first + span.size, sector * SectorId( span.sector, _GraphSymmetry.get() ) );
 }
 
 void DualGraph::normalizeVertices()
@@ -215,8 +374,8 @@ Json DualGraph::toJson() const
 Json DualGraph::Vertex::toJson() const
 {
    JsonArray neighborsJson;
-   for ( const auto& a : neighbors )
-      neighborsJson.push_back( a.toJson() );
+   for ( const GraphHandle& a : neighbors )
+      neighborsJson.push_back( JsonObj { {"index", a.index}, {"sectorId", a.sectorId} } );
 
    return JsonObj { {"index", index}, {"color", color}, {"pos", pos.toJson()}, {"neighbors", neighborsJson} };
 }
@@ -228,7 +387,7 @@ DualGraph::Vertex::Vertex( const Json& json, const DualGraph* graph )
    pos = XYZ( json["pos"] );
 
    for ( const Json& j : json["neighbors"].toArray() )
-      neighbors.push_back( VertexPtr( j, graph ) );
+      neighbors.push_back( VertexPtr( j, graph ).handle() );
 }
 
 Json DualGraph::VertexPtr::toJson() const
@@ -257,6 +416,7 @@ DualGraph::DualGraph( const Json& json )
       _Vertices.push_back( Vertex( j, this ) );
       _Vertices.back().symmetry = _GraphSymmetry->calcSectorSymmetry( _Vertices.back().pos );
    }
+   _IdStride = idStride( (int) _Vertices.size() );
 }
 
 void DualGraph::initFromIcoJson( const Json& json )
@@ -4,6 +4,7 @@
 #include "DataTypes.h"
 #include "Symmetry.h"
 #include "Defs.h"
+#include "SectorRange.h"
 
 #include <vector>
 #include <memory>
@@ -19,6 +20,7 @@ public:
    class VertexPtr
    {
       friend DualGraph;
+      friend Vertex;
    public:
       VertexPtr() {}
       VertexPtr( const DualGraph* graph, int index, const SectorId& sectorId ) 
@@ -31,6 +33,12 @@ public:
             *this = VertexPtr();
       }
       CORE_API VertexPtr( const Json& json, const DualGraph* graph );
+      VertexPtr( const DualGraph* graph, const GraphHandle& handle ) // `handle` is already canonical
+         : _Graph(graph)
+         , _Index(handle.index)
+         , _SectorId(handle.sectorId, graph->_GraphSymmetry.get())
+      {
+      }
 
       CORE_API bool operator==( const VertexPtr& rhs ) const { return _Graph == rhs._Graph && _Index == rhs._Index && _SectorId == rhs._SectorId; }
       CORE_API bool operator!=( const VertexPtr& rhs ) const { return !(*this == rhs); }
@@ -45,28 +53,19 @@ public:
       CORE_API VertexPtr              withSectorId( const SectorId& sectorId ) const { return VertexPtr( _Graph, _Index, sectorId ); }
       CORE_API VertexPtr              premul( const SectorId& mtx ) const;
       CORE_API VertexPtr              unpremul( const SectorId& mtx ) const;
-      CORE_API std::vector<VertexPtr> neighbors() const;
+      CORE_API std::vector<VertexPtr> neighbors() const { return neighborRange().toVector(); }
+      SectorRange<VertexPtr, DualGraph> neighborRange() const { return SectorRange<VertexPtr, DualGraph>( _Graph, baseVertex().neighbors, _SectorId ); }
       CORE_API std::vector<VertexPtr> diagonals() const;
       CORE_API std::vector<std::vector<DualGraph::VertexPtr>> edgesAndDiagonals() const;
       CORE_API bool                   isVisible() const { return _Graph->_GraphSymmetry->isSectorIdVisible( _SectorId.id() ); }
 
 
       CORE_API VertexPtr next( const VertexPtr& a ) const { return baseVertex().next( a.unpremul( _SectorId ) ).premul( _SectorId ); }
-      CORE_API std::vector<VertexPtr> polygon( const VertexPtr& a ) const
-      {
-         std::vector<VertexPtr> ret = { a, *this };
-         while ( true )
-         {
-            VertexPtr c = ret.back().next( ret[ret.size()-2] );
-            if ( !c.isValid() )
-               return {};
-            if ( c == ret[0] )
-               return ret;
-            ret.push_back( c );
-         }
-      }
-      CORE_API int id() const { return isValid() ? MAX_VERTICES * _SectorId.id() + _Index : -1; }
+      CORE_API std::vector<VertexPtr> polygon( const VertexPtr& a ) const;
+      CORE_API std::vector<VertexPtr> polygonAt( int slot ) const; // `polygon` of the neighbor at `slot`
+      CORE_API int64_t id() const { return isValid() ? _Graph->_IdStride * _SectorId.id() + _Index : -1; }
       CORE_API int index() const { return isValid() ? _Index : -1; }
+      CORE_API GraphHandle handle() const { return isValid() ? GraphHandle { _Index, _SectorId.id() } : GraphHandle(); }
       //CORE_API Matrix4x4 matrix() const { return _Matrix; }
       CORE_API SectorId sectorId() const { return _SectorId; }
 
@@ -84,6 +83,25 @@ public:
       SectorId _SectorId;
    };
 
+   // `_FaceVertices[begin, begin+size)` premultiplied by `sector`
+   struct FaceSpan
+   {
+      int begin = -1;                    // -1 if the face doesn't close
+      int size = 0;
+      int sector = 0;
+   };
+
+   // one per entry of a base vertex's `neighbors`, built by `sortNeighbors`.
+   // the instance of half-edge h in sector t runs from `_Vertices[h.origin]` in sector t to `h.target.premul( t )`
+   struct HalfEdge
+   {
+      int origin;
+      GraphHandle target;
+      int twin = -1;                     // in sector t * target.sectorId;  -1 if the edge is one-way
+      int rotateNext;                    // next half-edge counter-clockwise around `origin`
+      FaceSpan face[2];                  // left of the half-edge, starting origin, target, ...:  [0] in sectors that keep orientation, [1] in reflecting ones
+   };
+
    class Vertex
    {
    public:
@@ -93,36 +111,38 @@ public:
       VertexPtr toVertexPtr( const DualGraph* graph ) const { return VertexPtr( graph, index, SectorId::identity( graph->_GraphSymmetry.get() ) ); }
 
       //VertexPtr canonicalizedNeighbor( const VertexPtr& a ) const { return a; /*return a.withMatrix( symmetry->canonicalizedSector( a._Matrix ) );*/ }
-      bool hasNeighbor( VertexPtr a ) const { for ( const VertexPtr& neighb : neighbors ) if ( neighb == a ) return true; return false; }
-      void addNeighbor( VertexPtr a ) 
+      bool hasNeighbor( const VertexPtr& a ) const { return neighborIndexOf( a ) != -1; }
+      void addNeighbor( const VertexPtr& a ) 
       { 
          for ( const SectorId& premul : symmetry->sectorEquivalentsToIdentity() ) 
-            neighbors.push_back( a.premul( premul ) ); 
+            neighbors.push_back( a.premul( premul ).handle() ); 
       }
-      void removeNeighbor( VertexPtr a ) 
+      void removeNeighbor( const VertexPtr& a ) 
       { 
          for ( const SectorId& premul : symmetry->sectorEquivalentsToIdentity() ) 
          {
             size_t prevCt = neighbors.size();
-            neighbors.erase( std::remove_if( neighbors.begin(), neighbors.end(), [&]( const VertexPtr& b ) { return a.premul( premul ) == b; } ), neighbors.end() ); 
+            GraphHandle b = a.premul( premul ).handle();
+            neighbors.erase( std::remove( neighbors.begin(), neighbors.end(), b ), neighbors.end() ); 
             assert( neighbors.size() == prevCt - 1 );
          }
       }
       int neighborIndexOf( const VertexPtr& a ) const
       {
+         GraphHandle h = a.handle();
          for ( int i = 0; i < (int)neighbors.size(); i++ )
-            if ( a == neighbors[i] )
+            if ( h == neighbors[i] )
                return i;
          return -1;
       }
       VertexPtr next( const VertexPtr& a ) const // next neighbor counter-clockwise
       {
          int indexOfA = neighborIndexOf( a );
-         return indexOfA == -1 ? VertexPtr() : neighbors[(indexOfA+1)%(int)neighbors.size()];
+         return indexOfA == -1 ? VertexPtr() : VertexPtr( a._Graph, neighbors[(indexOfA+1)%(int)neighbors.size()] );
       }
       void eraseEdgesTo( int k )
       {
-         neighbors.erase( std::remove_if( neighbors.begin(), neighbors.end(), [k]( const VertexPtr& neighb ){ return neighb.index() == k; } ), neighbors.end() );
+         neighbors.erase( std::remove_if( neighbors.begin(), neighbors.end(), [k]( const GraphHandle& neighb ){ return neighb.index == k; } ), neighbors.end() );
       }
       Json toJson() const;
 
@@ -131,15 +151,16 @@ public:
       int color;
       XYZ pos;
       std::shared_ptr<SectorSymmetryForVertex> symmetry;
-      std::vector<VertexPtr> neighbors;
+      std::vector<GraphHandle> neighbors;
    };
 
    CORE_API DualGraph( std::shared_ptr<IGraphSymmetry> symmetry, std::shared_ptr<IGraphShape> shape );
    CORE_API DualGraph( const Json& json );
 
    CORE_API VertexPtr operator[]( int index ) const { return _Vertices[index].toVertexPtr( this ); }
-   CORE_API VertexPtr vertexWithName( const std::string& name ) const { for ( const VertexPtr& a : allVisibleVertices() ) if ( a.name() == name ) return a; return VertexPtr(); }
-   CORE_API VertexPtr vertexWithId( int id ) const { for ( const VertexPtr& a : allVisibleVertices() ) if ( a.id() == id ) return a; return VertexPtr(); }
+   CORE_API VertexPtr operator[]( const GraphHandle& handle ) const { return VertexPtr( this, handle ); }
+   CORE_API VertexPtr vertexWithName( const std::string& name ) const;
+   CORE_API VertexPtr vertexWithId( int64_t id ) const; // one of `allVisibleVertices`, decoded from the id
 
    CORE_API std::vector<VertexPtr> allVisibleVertices() const;
    CORE_API std::vector<VertexPtr> rawVertices() const;
@@ -150,10 +171,15 @@ public:
    CORE_API void setVertexColor( const VertexPtr& vtx, int color );
    CORE_API void setVertexPos( const VertexPtr& vtx, const XYZ& pos );
 
-   CORE_API void toggleEdge( int idA, int idB );   
+   CORE_API void toggleEdge( int64_t idA, int64_t idB );   
    CORE_API void toggleEdge( const VertexPtr& a, const VertexPtr& b );   
    CORE_API void sortNeighbors();
 
+   // faces in O(1) from the half-edges built by `sortNeighbors`
+   CORE_API bool hasHalfEdges() const { return !_FirstHalfEdge.empty(); }
+   CORE_API int firstHalfEdge( int index ) const { return _FirstHalfEdge[index]; }
+   CORE_API SectorRange<VertexPtr, DualGraph> face( int halfEdge, const SectorId& sector ) const; // throws if not `hasHalfEdges`
+
    CORE_API void normalizeVertices();
 
    CORE_API std::shared_ptr<IGraphShape> shape() { return _GraphShape; }
@@ -163,10 +189,16 @@ public:
 private:
    void initFromIcoJson( const Json& json );
    void swapVertexIndexes( int a, int b );
+   void buildHalfEdges();
+   void clearHalfEdges() { _HalfEdges.clear(); _FirstHalfEdge.clear(); _FaceVertices.clear(); }
 
 public:
    std::vector<Vertex> _Vertices;
    std::shared_ptr<IGraphSymmetry> _GraphSymmetry;
    std::shared_ptr<IGraphShape> _GraphShape;
+   std::vector<HalfEdge> _HalfEdges;
+   std::vector<int> _FirstHalfEdge; // half-edges of vertex v are [_FirstHalfEdge[v], _FirstHalfEdge[v+1]), in `neighbors` order
+   std::vector<GraphHandle> _FaceVertices; // each face once per orbit, stored twice in a row so that every rotation of it is contiguous
+   int64_t _IdStride = idStride( 0 ); // see `idStride`, only grows
 };
 
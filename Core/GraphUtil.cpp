@@ -3,46 +3,121 @@
 #include "TileGraph.h"
 
 #include <map>
-#include <set>
-#include <functional>
+#include <unordered_map>
+#include <memory_resource>
 
-class PolyToVertexMap
+namespace
 {
-public:
-   PolyToVertexMap( DualGraph& dual ) : _Dual( dual )
+   typedef std::pmr::vector<DualGraph::VertexPtr> DualPolygon;
+
+   // sorted ids of a polygon, inline for the usual small ones
+   struct PolyKey
    {
-   }
+      static const int MAX_SIZE = 8;
+
+      int size = 0;
+      int64_t ids[MAX_SIZE];
 
-   TileGraph::VertexPtr createOrFindTileGraphVertex( const std::vector<DualGraph::VertexPtr>& poly, std::function<TileGraph::VertexPtr(const XYZ&)> createVertexFunc )
+      bool operator==( const PolyKey& rhs ) const { return size == rhs.size && std::equal( ids, ids + size, rhs.ids ); }
+      bool operator<( const PolyKey& rhs ) const { return std::lexicographical_compare( ids, ids + size, rhs.ids, rhs.ids + rhs.size ); }
+   };
+   struct PolyKeyHash
    {
-      // check cache
-      for ( const SectorId& sector : _Dual._GraphSymmetry->allSectors() )
+      size_t operator()( const PolyKey& key ) const
       {
-         std::set<int> polyAsSet;
-         for ( const DualGraph::VertexPtr& c : poly )
-            polyAsSet.insert( c.premul( sector ).id() );
-         if ( _DualPolygonToTileVertex.count( polyAsSet ) )
-            return _DualPolygonToTileVertex.at(polyAsSet).premul( sector.inverted() );
+         uint64_t h = 14695981039346656037ull;
+         for ( int i = 0; i < key.size; i++ )
+            h = ( h ^ (uint64_t) key.ids[i] ) * 1099511628211ull;
+         return (size_t) h;
       }
+   };
 
-      // create new
-      std::set<int> polyAsSet;
-      for ( const DualGraph::VertexPtr& c : poly )
-         polyAsSet.insert( c.id() );
+   // dual polygons are the same tile vertex if they're in the same orbit of the symmetry, so each polygon is moved to a
+   // canonical member of its orbit:  its lowest-indexed dual vertex is moved to sector 0, in each way the vertex allows, and the
+   // smallest key wins.  The tile vertex is stored for that canonical polygon, and moved back by the same sector on lookup
+   class PolyToVertexMap
+   {
+   public:
+      PolyToVertexMap( std::pmr::memory_resource* arena ) : _DualPolygonToTileVertex( arena ), _LargePolygonToTileVertex( arena ), _LargeKey( arena ), _Scratch( arena ) {}
 
-      XYZ sum;
-      for ( const DualGraph::VertexPtr& c : poly )
-         sum += c.pos();
+      // the tile vertex already made for `poly`'s orbit, moved to `poly`;  invalid if there is none
+      TileGraph::VertexPtr find( const DualPolygon& poly )
+      {
+         SectorId sector = canonicalize( poly );
+         TileGraph::VertexPtr ret;
+         if ( _Key.size <= PolyKey::MAX_SIZE )
+         {
+            auto it = _DualPolygonToTileVertex.find( _Key );
+            if ( it != _DualPolygonToTileVertex.end() )
+               ret = it->second;
+         }
+         else
+         {
+            auto it = _LargePolygonToTileVertex.find( _LargeKey );
+            if ( it != _LargePolygonToTileVertex.end() )
+               ret = it->second;
+         }
+         return ret.isValid() ? ret.premul( sector.inverted() ) : ret;
+      }
 
-      return _DualPolygonToTileVertex[polyAsSet] = createVertexFunc( sum / poly.size() );
-   }
+      void insert( const DualPolygon& poly, const TileGraph::VertexPtr& tileVertex )
+      {
+         SectorId sector = canonicalize( poly );
+         if ( _Key.size <= PolyKey::MAX_SIZE )
+            _DualPolygonToTileVertex.emplace( _Key, tileVertex.premul( sector ) );
+         else
+            _LargePolygonToTileVertex.emplace( _LargeKey, tileVertex.premul( sector ) );
+      }
+
+   private:
+      // sets `_Key` (or `_LargeKey`) to the key of the canonical member of `poly`'s orbit, and returns the sector that moves `poly` there
+      SectorId canonicalize( const DualPolygon& poly )
+      {
+         int minIndex = poly[0].index();
+         for ( const DualGraph::VertexPtr& c : poly )
+            minIndex = std::min( minIndex, c.index() );
 
-public:
-   DualGraph& _Dual;
-   std::map<std::set<int>, TileGraph::VertexPtr> _DualPolygonToTileVertex;
-};
+         SectorId best;
+         bool isFirst = true;
+         for ( const DualGraph::VertexPtr& c : poly ) if ( c.index() == minIndex )
+            for ( const SectorId& k : c.baseVertex().symmetry->sectorEquivalentsToIdentity() )
+            {
+               SectorId sector = k * c.sectorId().inverted();
+               makeKey( poly, sector, _Scratch );
+               if ( isFirst || _Scratch < _LargeKey )
+               {
+                  _LargeKey.swap( _Scratch );
+                  best = sector;
+                  isFirst = false;
+               }
+            }
 
-std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual, double radius )
+         _Key.size = (int) _LargeKey.size();
+         if ( _Key.size <= PolyKey::MAX_SIZE )
+            std::copy( _LargeKey.begin(), _LargeKey.end(), _Key.ids );
+         return best;
+      }
+
+      // sorted ids of `poly` moved to `sector`
+      void makeKey( const DualPolygon& poly, const SectorId& sector, std::pmr::vector<int64_t>& key ) const
+      {
+         key.clear();
+         for ( const DualGraph::VertexPtr& c : poly )
+            key.push_back( c.premul( sector ).id() );
+         std::sort( key.begin(), key.end() );
+         key.erase( std::unique( key.begin(), key.end() ), key.end() );
+      }
+
+   private:
+      std::pmr::unordered_map<PolyKey, TileGraph::VertexPtr, PolyKeyHash> _DualPolygonToTileVertex;
+      std::pmr::map<std::pmr::vector<int64_t>, TileGraph::VertexPtr> _LargePolygonToTileVertex; // more than PolyKey::MAX_SIZE vertices
+      PolyKey _Key;                          // scratch
+      std::pmr::vector<int64_t> _LargeKey;   // scratch
+      std::pmr::vector<int64_t> _Scratch;
+   };
+}
+
+std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual )
 {
    dual.sortNeighbors();
 
@@ -50,10 +125,15 @@ std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual, double radius )
    graph->_GraphShape = dual._GraphShape;
    graph->_GraphSymmetry = dual._GraphSymmetry;
 
-   //std::map<std::set<int>, TileGraph::VertexPtr> dualPolygonToTileVertex;
-   PolyToVertexMap dualPolygonToTileVertexMap( dual );
-   std::map<int, std::vector<DualGraph::VertexPtr>> polyMap;
+   // all the scratch below comes from one arena, released in one go on return
+   std::pmr::monotonic_buffer_resource arena;
+   PolyToVertexMap dualPolygonToTileVertexMap( &arena );
+   std::pmr::vector<int> polyStart( &arena );             // dual polygon of tile vertex v:  polyVertices[polyStart[v] .. polyStart[v+1])
+   std::pmr::vector<GraphHandle> polyVertices( &arena );
+   DualPolygon polys[2] = { DualPolygon( &arena ), DualPolygon( &arena ) };
+   std::vector<XYZ> polyPositions;
 
+   graph->_Tiles.reserve( dual._Vertices.size() );
    for ( const DualGraph::VertexPtr& a : dual.rawVertices() )
    {
       TileGraph::Tile tile;
@@ -61,54 +141,90 @@ std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual, double radius )
       tile._Color = a.color();
       tile._Symmetry = a.baseVertex().symmetry;
 
-      for ( const DualGraph::VertexPtr& b : a.neighbors() )
+      for ( int h = dual.firstHalfEdge( a.index() ); h < dual.firstHalfEdge( a.index()+1 ); h++ )
       {
-         std::vector<std::vector<DualGraph::VertexPtr>> polys = { a.polygon( b ) };
-         bool onPerimeter = polys[0].empty() || !dual._GraphShape->isValidWinding( positionsOf( polys[0] ) );
+         // the face on the far side of a->b, or on the perimeter the two edges on either side
+         const DualGraph::HalfEdge& ab = dual._HalfEdges[h];
+         polys[0].clear();
+         if ( ab.twin != -1 )
+            for ( const DualGraph::VertexPtr& c : dual.face( ab.twin, dual[ab.target].sectorId() ) )
+               polys[0].push_back( c );
+         polyPositions.clear();
+         for ( const DualGraph::VertexPtr& c : polys[0] )
+            polyPositions.push_back( c.pos() );
+         bool onPerimeter = polys[0].empty() || !dual._GraphShape->isValidWinding( polyPositions );
+         int numPolys = 1;
          if ( onPerimeter )
-            polys = { { a, b }, { a, a.next( b ) } };
+         {
+            polys[0].assign( { a, dual[ab.target] } );
+            polys[1].assign( { a, dual[dual._HalfEdges[ab.rotateNext].target] } );
+            numPolys = 2;
+         }
 
-         for ( std::vector<DualGraph::VertexPtr>& poly : polys )
+         for ( int i = 0; i < numPolys; i++ )
          {
-            TileGraph::VertexPtr tileVertex = dualPolygonToTileVertexMap.createOrFindTileGraphVertex( poly, [&]( const XYZ& pos ) {
-               TileGraph::Vertex& v = graph->addVertex( graph->_GraphShape->toSurfaceFrom3D( pos ) );
-               polyMap[v._Index] = poly; // used to populate tile neighbors later
+            const DualPolygon& poly = polys[i];
+            TileGraph::VertexPtr tileVertex = dualPolygonToTileVertexMap.find( poly );
+            if ( !tileVertex.isValid() )
+            {
+               XYZ sum;
+               for ( const DualGraph::VertexPtr& c : poly )
+                  sum += c.pos();
+               TileGraph::Vertex& v = graph->addVertex( graph->_GraphShape->toSurfaceFrom3D( sum / poly.size() ) );
                v._OnPerimeter = onPerimeter;
-               return v.toVertexPtr( graph.get() );
-            } );
+               tileVertex = v.toVertexPtr( graph.get() );
+               dualPolygonToTileVertexMap.insert( poly, tileVertex );
+
+               polyStart.push_back( (int) polyVertices.size() ); // used to populate tile neighbors later
+               for ( const DualGraph::VertexPtr& c : poly )
+                  polyVertices.push_back( c.handle() );
+            }
 
             assert( tileVertex.isValid() );
-            tile._Vertices.push_back( tileVertex );
+            tile._Vertices.push_back( tileVertex.handle() );
          }
       }
       graph->_Tiles.push_back( tile );
    }
+   polyStart.push_back( (int) polyVertices.size() );
 
-   // populate vertex `_Tiles`
-   for ( auto& pr : polyMap )
-   for ( const DualGraph::VertexPtr& c : pr.second )
-      graph->_Vertices[pr.first]._Tiles.push_back( TileGraph::TilePtr( graph.get(), c.index(), c.sectorId() ) );
+   // populate vertex tiles:  the dual vertices around each
+   int numVertices = (int) graph->_Vertices.size();
+   graph->_VertexTileStart.reserve( numVertices + 1 );
+   graph->_VertexTiles.reserve( polyVertices.size() );
+   graph->_VertexTileCorners.reserve( polyVertices.size() );
+   for ( int v = 0; v < numVertices; v++ )
+   {
+      graph->_VertexTileStart.push_back( (int) graph->_VertexTiles.size() );
+      for ( int k = polyStart[v]; k < polyStart[v+1]; k++ )
+      {
+         TileGraph::TilePtr tile( graph.get(), polyVertices[k].index, SectorId( polyVertices[k].sectorId, graph->_GraphSymmetry.get() ) );
+         graph->_VertexTiles.push_back( tile.handle() );
+         graph->_VertexTileCorners.push_back( tile.baseTile().cornerOf( graph->_Vertices[v].toVertexPtr( graph.get() ).premul( tile.sectorId().inverted() ).handle() ) );
+      }
+   }
+   graph->_VertexTileStart.push_back( (int) graph->_VertexTiles.size() );
 
-   // populate vertex `_Neighbors`
-   for ( const TileGraph::VertexPtr& a : graph->rawVertices() )
+   // populate vertex neighbors
+   graph->_VertexNeighborStart.reserve( numVertices + 1 );
+   graph->_VertexNeighbors.reserve( 2 * graph->_VertexTiles.size() );
+   for ( int v = 0; v < numVertices; v++ )
    {
-      std::vector<TileGraph::TilePtr> tiles = a.tiles();
-      for ( int i = 0; i < (int) tiles.size(); i++ )
+      graph->_VertexNeighborStart.push_back( (int) graph->_VertexNeighbors.size() );
+      int first = graph->_VertexTileStart[v];
+      int numTiles = graph->_VertexTileStart[v+1] - first;
+      for ( int i = 0; i < numTiles; i++ )
       {
-         const TileGraph::TilePtr& tile = tiles[i];
-         const TileGraph::TilePtr& nextTile = tiles[(i+1)%tiles.size()];
-         const TileGraph::VertexPtr v0 = tile.next( a );
-         const TileGraph::VertexPtr v1 = nextTile.prev( a );
+         int j = first + (i+1) % numTiles;
+         const TileGraph::VertexPtr v0 = graph->tile( graph->_VertexTiles[first+i] ).corner( graph->_VertexTileCorners[first+i]+1 );
+         const TileGraph::VertexPtr v1 = graph->tile( graph->_VertexTiles[j] ).corner( graph->_VertexTileCorners[j]-1 );
 
-         graph->_Vertices[a.index()]._Neighbors.push_back( v0 );
+         graph->_VertexNeighbors.push_back( v0.handle() );
          if ( v0 != v1 )
-            graph->_Vertices[a.index()]._Neighbors.push_back( v1 );
+            graph->_VertexNeighbors.push_back( v1.handle() );
       }
    }
-
-   //   for ( const Graph::VertexPtr& a : graph->allVertices() )
-   //      for ( const Graph::VertexPtr& b : graph->neighbors( a ) )
-   //         qDebug() << graph->idOf( a ) << "-" << graph->idOf( b );
+   graph->_VertexNeighborStart.push_back( (int) graph->_VertexNeighbors.size() );
 
    return graph;
 }
@@ -10,7 +10,7 @@
 class TileGraph;
 class DualGraph;
 
-CORE_API std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual, double radius );
+CORE_API std::shared_ptr<TileGraph> makeTileGraph( DualGraph& dual );
 
 CORE_API std::ostream& operator<<( std::ostream& os, const DualGraph::VertexPtr& a );
 CORE_API std::ostream& operator<<( std::ostream& os, const TileGraph::VertexPtr& a );
@@ -0,0 +1,59 @@
+#include "Lbfgs.h"
+
+double Lbfgs::dot( const std::vector<XYZ>& a, const std::vector<XYZ>& b )
+{
+   double ret = 0;
+   for ( int i = 0; i < (int)a.size(); i++ )
+      ret += a[i] * b[i];
+   return ret;
+}
+
+std::vector<XYZ> Lbfgs::direction( const std::vector<XYZ>& grad ) const
+{
+   // two-loop recursion
+   std::vector<XYZ> q = grad;
+   int m = (int) _S.size();
+   std::vector<double> alpha( m );
+   for ( int i = m-1; i >= 0; i-- )
+   {
+      alpha[i] = _Rho[i] * dot( _S[i], q );
+      for ( int k = 0; k < (int)q.size(); k++ )
+         q[k] -= _Y[i][k] * alpha[i];
+   }
+
+   // initial Hessian  H0 = (s*y)/(y*y) * I  from the newest pair
+   if ( m > 0 )
+   {
+      double gamma = dot( _S[m-1], _Y[m-1] ) / dot( _Y[m-1], _Y[m-1] );
+      for ( XYZ& v : q )
+         v *= gamma;
+   }
+
+   for ( int i = 0; i < m; i++ )
+   {
+      double beta = _Rho[i] * dot( _Y[i], q );
+      for ( int k = 0; k < (int)q.size(); k++ )
+         q[k] += _S[i][k] * (alpha[i] - beta);
+   }
+
+   for ( XYZ& v : q )
+      v = -v;
+   return q;
+}
+
+void Lbfgs::update( const std::vector<XYZ>& s, const std::vector<XYZ>& y )
+{
+   double sy = dot( s, y );
+   if ( !( sy > 1e-20 ) )
+      return;
+
+   _S.push_back( s );
+   _Y.push_back( y );
+   _Rho.push_back( 1. / sy );
+   if ( (int)_S.size() > _HistorySize )
+   {
+      _S.pop_front();
+      _Y.pop_front();
+      _Rho.pop_front();
+   }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "CoreMacros.h"
+#include "DataTypes.h"
+
+#include <vector>
+#include <deque>
+
+// limited-memory BFGS inverse-Hessian approximation over per-vertex 3D vectors
+class Lbfgs
+{
+public:
+   Lbfgs( int historySize = 8 ) : _HistorySize( historySize ) {}
+
+   void reset() { _S.clear(); _Y.clear(); _Rho.clear(); }
+   bool isEmpty() const { return _S.empty(); }
+
+   // search direction  -H * grad
+   std::vector<XYZ> direction( const std::vector<XYZ>& grad ) const;
+
+   // adds the pair  s = x1-x0, y = grad1-grad0  (skipped unless s*y > 0, which keeps H positive definite)
+   void update( const std::vector<XYZ>& s, const std::vector<XYZ>& y );
+
+   static double dot( const std::vector<XYZ>& a, const std::vector<XYZ>& b );
+
+private:
+   int _HistorySize;
+   std::deque<std::vector<XYZ>> _S;
+   std::deque<std::vector<XYZ>> _Y;
+   std::deque<double> _Rho;
+};
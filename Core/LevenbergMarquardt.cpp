@@ -0,0 +1,239 @@
+#include "LevenbergMarquardt.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+   const double CG_TOLERANCE = 1e-12; // relative residual
+   const int CG_MIN_ITERATIONS = 100;
+
+   double dot( const std::vector<double>& a, const std::vector<double>& b )
+   {
+      double ret = 0;
+      for ( int i = 0; i < (int)a.size(); i++ )
+         ret += a[i] * b[i];
+      return ret;
+   }
+}
+
+void LevenbergMarquardt::clear()
+{
+   _Movable.clear();
+   _VarOfVertex.clear();
+   _VertexOfVar.clear();
+   _PerimeterVars.clear();
+   _RowStart.clear();
+   _Col.clear();
+   _DiagSlot.clear();
+   _SlotAB.clear();
+   _SlotBA.clear();
+}
+
+void LevenbergMarquardt::compile( const TileGraph& graph, const ConstraintProgram& program, const std::vector<bool>& movable )
+{
+   clear();
+   _Movable = movable;
+
+   _VarOfVertex.assign( movable.size(), -1 );
+   for ( int i = 0; i < (int)movable.size(); i++ ) if ( movable[i] )
+   {
+      _VarOfVertex[i] = (int) _VertexOfVar.size();
+      _VertexOfVar.push_back( i );
+      if ( graph._Vertices[i]._OnPerimeter )
+         _PerimeterVars.push_back( _VarOfVertex[i] );
+   }
+   int numVars = (int) _VertexOfVar.size();
+
+   // pattern:  the diagonal, plus both ends of every constraint between two variables
+   std::vector<std::vector<int>> cols( numVars );
+   for ( int v = 0; v < numVars; v++ )
+      cols[v].push_back( v );
+   for ( int k = 0; k < program.size(); k++ )
+   {
+      int va = _VarOfVertex[program._A[k]];
+      int vb = _VarOfVertex[program._B[k]];
+      if ( va < 0 || vb < 0 )
+         continue;
+      cols[va].push_back( vb );
+      cols[vb].push_back( va );
+   }
+
+   _RowStart.push_back( 0 );
+   for ( std::vector<int>& row : cols )
+   {
+      std::sort( row.begin(), row.end() );
+      row.erase( std::unique( row.begin(), row.end() ), row.end() );
+      _Col.insert( _Col.end(), row.begin(), row.end() );
+      _RowStart.push_back( (int) _Col.size() );
+   }
+
+   auto slot = [&]( int row, int col ) {
+      return (int) ( std::lower_bound( _Col.begin() + _RowStart[row], _Col.begin() + _RowStart[row+1], col ) - _Col.begin() );
+   };
+   for ( int v = 0; v < numVars; v++ )
+      _DiagSlot.push_back( slot( v, v ) );
+   for ( int k = 0; k < program.size(); k++ )
+   {
+      int va = _VarOfVertex[program._A[k]];
+      int vb = _VarOfVertex[program._B[k]];
+      _SlotAB.push_back( va >= 0 && vb >= 0 ? slot( va, vb ) : -1 );
+      _SlotBA.push_back( va >= 0 && vb >= 0 ? slot( vb, va ) : -1 );
+   }
+
+   _Blocks.resize( _Col.size() );
+   _Rhs.resize( 2 * numVars );
+   _U.resize( numVars );
+   _V.resize( numVars );
+   _Lin.resize( program.size() );
+   _InvDiag.resize( numVars );
+}
+
+void LevenbergMarquardt::addOuter( int slot, double w, const double* a, const double* b )
+{
+   double* m = _Blocks[slot].m;
+   m[0] += w * a[0] * b[0];
+   m[1] += w * a[0] * b[1];
+   m[2] += w * a[1] * b[0];
+   m[3] += w * a[1] * b[1];
+}
+
+void LevenbergMarquardt::linearize( ConstraintProgram& program, const TileGraph& graph, const std::vector<XYZ>& pos, double padding, double perimeterRadius )
+{
+   int numVars = (int) _VertexOfVar.size();
+   visitShape( *graph._GraphShape, [&]( const auto& shape ) {
+      for ( int v = 0; v < numVars; v++ )
+      {
+         XYZ n = shape.normalAt( pos[_VertexOfVar[v]] );
+         XYZ axis = std::abs( n.x ) < .9 ? XYZ( 1, 0, 0 ) : XYZ( 0, 1, 0 );
+         _U[v] = ( axis ^ n ).normalized();
+         _V[v] = n ^ _U[v];
+      }
+   } );
+   std::fill( _Blocks.begin(), _Blocks.end(), Block { { 0, 0, 0, 0 } } );
+   std::fill( _Rhs.begin(), _Rhs.end(), 0. );
+
+   program.linearize( 0, program.size(), pos, padding, _Lin );
+   for ( int k = 0; k < program.size(); k++ )
+   {
+      const ConstraintProgram::Linearization& lin = _Lin[k];
+      if ( lin.numActive == 0 )
+         continue;
+
+      // Jacobian row of one hinge, restricted to the tangent coordinates of each end
+      int va = _VarOfVertex[program._A[k]];
+      int vb = _VarOfVertex[program._B[k]];
+      double ja[2] = { 0, 0 };
+      double jb[2] = { 0, 0 };
+      if ( va >= 0 ) { ja[0] = lin.gradA * _U[va]; ja[1] = lin.gradA * _V[va]; }
+      if ( vb >= 0 ) { jb[0] = lin.gradB * _U[vb]; jb[1] = lin.gradB * _V[vb]; }
+
+      double w = lin.numActive;
+      if ( va >= 0 )
+      {
+         addOuter( _DiagSlot[va], w, ja, ja );
+         _Rhs[2*va]   -= lin.residual * ja[0];
+         _Rhs[2*va+1] -= lin.residual * ja[1];
+      }
+      if ( vb >= 0 )
+      {
+         addOuter( _DiagSlot[vb], w, jb, jb );
+         _Rhs[2*vb]   -= lin.residual * jb[0];
+         _Rhs[2*vb+1] -= lin.residual * jb[1];
+      }
+      if ( va >= 0 && vb >= 0 )
+      {
+         addOuter( _SlotAB[k], w, ja, jb );
+         addOuter( _SlotBA[k], w, jb, ja );
+      }
+   }
+
+   // perimeter:  residual |p|-perimeterRadius while inside
+   for ( int v : _PerimeterVars )
+   {
+      const XYZ& p = pos[_VertexOfVar[v]];
+      if ( p.len2() > perimeterRadius*perimeterRadius )
+         continue;
+
+      double d = p.len();
+      double j[2] = { p * _U[v] / d, p * _V[v] / d };
+      addOuter( _DiagSlot[v], 1., j, j );
+      _Rhs[2*v]   -= ( d - perimeterRadius ) * j[0];
+      _Rhs[2*v+1] -= ( d - perimeterRadius ) * j[1];
+   }
+}
+
+void LevenbergMarquardt::multiply( double lambda, const std::vector<double>& x, std::vector<double>& out ) const
+{
+   int numVars = (int) _VertexOfVar.size();
+   for ( int r = 0; r < numVars; r++ )
+   {
+      double y0 = lambda * x[2*r];
+      double y1 = lambda * x[2*r+1];
+      for ( int s = _RowStart[r]; s < _RowStart[r+1]; s++ )
+      {
+         const double* m = _Blocks[s].m;
+         int c = _Col[s];
+         y0 += m[0] * x[2*c] + m[1] * x[2*c+1];
+         y1 += m[2] * x[2*c] + m[3] * x[2*c+1];
+      }
+      out[2*r] = y0;
+      out[2*r+1] = y1;
+   }
+}
+
+void LevenbergMarquardt::solve( double lambda, std::vector<XYZ>& delta )
+{
+   int numVars = (int) _VertexOfVar.size();
+   int n = 2 * numVars;
+
+   // block Jacobi preconditioner
+   for ( int v = 0; v < numVars; v++ )
+   {
+      const double* m = _Blocks[_DiagSlot[v]].m;
+      double a = m[0] + lambda, b = m[1], c = m[2], d = m[3] + lambda;
+      double det = a * d - b * c;
+      _InvDiag[v] = Block { { d / det, -b / det, -c / det, a / det } };
+   }
+   auto precondition = [&]( const std::vector<double>& in, std::vector<double>& out ) {
+      for ( int v = 0; v < numVars; v++ )
+      {
+         const double* m = _InvDiag[v].m;
+         out[2*v]   = m[0] * in[2*v] + m[1] * in[2*v+1];
+         out[2*v+1] = m[2] * in[2*v] + m[3] * in[2*v+1];
+      }
+   };
+
+   _X.assign( n, 0. );
+   _R = _Rhs;
+   _Z.resize( n );
+   _AP.resize( n );
+   precondition( _R, _Z );
+   _P = _Z;
+   double rz = dot( _R, _Z );
+   double tolerance2 = dot( _Rhs, _Rhs ) * CG_TOLERANCE * CG_TOLERANCE;
+   int maxIterations = std::max( CG_MIN_ITERATIONS, 2 * n );
+   for ( int iter = 0; iter < maxIterations && dot( _R, _R ) > tolerance2; iter++ )
+   {
+      multiply( lambda, _P, _AP );
+      double pAp = dot( _P, _AP );
+      if ( !( pAp > 0 ) )
+         break;
+      double alpha = rz / pAp;
+      for ( int i = 0; i < n; i++ )
+      {
+         _X[i] += _P[i] * alpha;
+         _R[i] -= _AP[i] * alpha;
+      }
+      precondition( _R, _Z );
+      double rzNew = dot( _R, _Z );
+      double beta = rzNew / rz;
+      rz = rzNew;
+      for ( int i = 0; i < n; i++ )
+         _P[i] = _Z[i] + _P[i] * beta;
+   }
+
+   delta.assign( _VarOfVertex.size(), XYZ() );
+   for ( int v = 0; v < numVars; v++ )
+      delta[_VertexOfVar[v]] = _U[v] * _X[2*v] + _V[v] * _X[2*v+1];
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "CoreMacros.h"
+#include "DataTypes.h"
+#include "TileGraph.h"
+#include "ConstraintProgram.h"
+
+#include <vector>
+
+// damped Gauss-Newton steps on the penalty energy of a `ConstraintProgram`, over the tangent planes of the movable vertices
+// the active set (which hinges of which constraints are violated) is re-evaluated by every `linearize`,
+// but the block sparsity pattern of J^T*J comes from all constraints, so it is built once by `compile`
+class LevenbergMarquardt
+{
+public:
+   // `movable[i]` = vertex i is a variable, the others stay fixed
+   void compile( const TileGraph& graph, const ConstraintProgram& program, const std::vector<bool>& movable );
+   void clear();
+   bool isCompiled( const std::vector<bool>& movable ) const { return !_RowStart.empty() && movable == _Movable; }
+
+   // builds J^T*J and J^T*r at `pos`, for the constraints of `program` and for keeping the perimeter vertices outside `perimeterRadius`
+   void linearize( ConstraintProgram& program, const TileGraph& graph, const std::vector<XYZ>& pos, double padding, double perimeterRadius );
+
+   // solves  (J^T*J + lambda*I) * x = -J^T*r  (preconditioned conjugate gradient), returns the per-vertex displacement
+   void solve( double lambda, std::vector<XYZ>& delta );
+
+private:
+   struct Block // 2x2, row-major
+   {
+      double m[4];
+   };
+
+   void addOuter( int slot, double w, const double* a, const double* b );
+   void multiply( double lambda, const std::vector<double>& x, std::vector<double>& out ) const;
+
+private:
+   std::vector<bool> _Movable;
+   std::vector<int>  _VarOfVertex;  // -1 if the vertex is fixed
+   std::vector<int>  _VertexOfVar;
+   std::vector<int>  _PerimeterVars;
+
+   // block CSR pattern of J^T*J
+   std::vector<int> _RowStart;
+   std::vector<int> _Col;
+   std::vector<int> _DiagSlot;     // per var
+   std::vector<int> _SlotAB;       // per constraint, -1 unless both ends are variables
+   std::vector<int> _SlotBA;
+
+   // values
+   std::vector<Block>  _Blocks;
+   std::vector<double> _Rhs;       // -J^T*r, 2 per var
+   std::vector<XYZ>    _U;         // tangent basis per var
+   std::vector<XYZ>    _V;
+
+private: // scratch
+   std::vector<ConstraintProgram::Linearization> _Lin;
+   std::vector<Block>  _InvDiag;
+   std::vector<double> _X, _R, _Z, _P, _AP;
+};
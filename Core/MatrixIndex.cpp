@@ -0,0 +1,141 @@
+#include "MatrixIndex.h"
+
+#include <cmath>
+
+namespace
+{
+   uint64_t mix( uint64_t h )
+   {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+   }
+}
+
+void MatrixIndex::quantize( const Matrix4x4& m, int64_t* q, int64_t* alternative )
+{
+   for ( int c = 0; c < 4; c++ )
+   {
+      const double v[4] = { m[c].x, m[c].y, m[c].z, m[c].w };
+      for ( int r = 0; r < 4; r++ )
+      {
+         double x = v[r] / QUANTUM;
+         double rounded = std::floor( x + .5 );
+         q[c*4+r] = (int64_t) rounded;
+
+         // the other side of the nearest rounding boundary, if `v` is that close to it
+         double boundary = x < rounded ? rounded - .5 : rounded + .5;
+         alternative[c*4+r] = std::abs( x - boundary ) * QUANTUM < TOLERANCE ? ( x < rounded ? q[c*4+r] - 1 : q[c*4+r] + 1 ) : q[c*4+r];
+      }
+   }
+}
+
+void MatrixIndex::key( const int64_t* q, uint64_t& keyA, uint64_t& keyB )
+{
+   keyA = 0x243f6a8885a308d3ULL;
+   keyB = 0x13198a2e03707344ULL;
+   for ( int i = 0; i < 16; i++ )
+   {
+      keyA = mix( keyA ^ (uint64_t) q[i] );
+      keyB = mix( keyB + (uint64_t) q[i] * 0x9e3779b97f4a7c15ULL );
+   }
+}
+
+int MatrixIndex::findKey( uint64_t keyA, uint64_t keyB ) const
+{
+   if ( _Slots.empty() )
+      return -1;
+   size_t mask = _Slots.size() - 1;
+   for ( size_t i = keyA & mask; _Slots[i].value >= 0; i = ( i + 1 ) & mask )
+      if ( _Slots[i].keyA == keyA && _Slots[i].keyB == keyB )
+         return _Slots[i].value;
+   return -1;
+}
+
+void MatrixIndex::insertKey( uint64_t keyA, uint64_t keyB, int value )
+{
+   size_t mask = _Slots.size() - 1;
+   size_t i = keyA & mask;
+   while ( _Slots[i].value >= 0 )
+      i = ( i + 1 ) & mask;
+   _Slots[i] = Slot { keyA, keyB, value };
+}
+
+void MatrixIndex::grow()
+{
+   std::vector<Slot> old;
+   old.swap( _Slots );
+   _Slots.resize( old.empty() ? 64 : 2 * old.size() );
+   for ( const Slot& slot : old )
+      if ( slot.value >= 0 )
+         insertKey( slot.keyA, slot.keyB, slot.value );
+}
+
+void MatrixIndex::insert( const Matrix4x4& m, int value )
+{
+   if ( 2 * ( _Size + 1 ) > (int) _Slots.size() )
+      grow();
+
+   int64_t q[16], alternative[16];
+   quantize( m, q, alternative );
+   uint64_t keyA, keyB;
+   key( q, keyA, keyB );
+   insertKey( keyA, keyB, value );
+   _Size++;
+
+   Entry entry;
+   for ( int i = 0; i < 16; i++ )
+      entry.q[i] = q[i];
+   entry.value = value;
+   _Entries.push_back( entry );
+}
+
+int MatrixIndex::findLinear( const int64_t* q, const int64_t* alternative ) const
+{
+   for ( const Entry& entry : _Entries )
+   {
+      bool match = true;
+      for ( int i = 0; i < 16 && match; i++ )
+         match = entry.q[i] == q[i] || entry.q[i] == alternative[i];
+      if ( match )
+         return entry.value;
+   }
+   return -1;
+}
+
+int MatrixIndex::find( const Matrix4x4& m ) const
+{
+   int64_t q[16], alternative[16];
+   quantize( m, q, alternative );
+
+   int ambiguous[16];
+   int numAmbiguous = 0;
+   for ( int i = 0; i < 16; i++ )
+      if ( alternative[i] != q[i] )
+         ambiguous[numAmbiguous++] = i;
+
+   // too many combinations to probe, e.g. a matrix with many entries on a rounding boundary
+   if ( numAmbiguous > MAX_AMBIGUOUS )
+      return findLinear( q, alternative );
+
+   // every combination of the ambiguous entries (almost always just one)
+   for ( int combination = 0; combination < ( 1 << numAmbiguous ); combination++ )
+   {
+      int64_t probe[16];
+      for ( int i = 0; i < 16; i++ )
+         probe[i] = q[i];
+      for ( int k = 0; k < numAmbiguous; k++ )
+         if ( combination & ( 1 << k ) )
+            probe[ambiguous[k]] = alternative[ambiguous[k]];
+
+      uint64_t keyA, keyB;
+      key( probe, keyA, keyB );
+      int ret = findKey( keyA, keyB );
+      if ( ret >= 0 )
+         return ret;
+   }
+   return -1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "DataTypes.h"
+
+#include <vector>
+#include <cstdint>
+
+// map from matrix to int, for looking up sector ids.  The 16 entries are quantized to a grid much coarser than the
+// rounding error of matrix products and hashed to a 128-bit key, in an open-addressing table (no allocation per lookup).
+// An entry that lies within `TOLERANCE` of a rounding boundary is looked up on both sides of it; past `MAX_AMBIGUOUS`
+// such entries the lookup falls back to a linear scan instead of probing every combination
+class MatrixIndex
+{
+public:
+   static constexpr double QUANTUM = 1. / 65536;
+   static constexpr double TOLERANCE = 1e-8;
+   static const int MAX_AMBIGUOUS = 4;
+
+   // `m` must not be in the index yet
+   void insert( const Matrix4x4& m, int value );
+   // -1 if not found
+   int find( const Matrix4x4& m ) const;
+   int size() const { return _Size; }
+
+private:
+   struct Slot
+   {
+      uint64_t keyA;
+      uint64_t keyB;
+      int value = -1; // -1 = empty
+   };
+   struct Entry
+   {
+      int64_t q[16];
+      int value;
+   };
+
+   static void quantize( const Matrix4x4& m, int64_t* q, int64_t* alternative );
+   static void key( const int64_t* q, uint64_t& keyA, uint64_t& keyB );
+   int findKey( uint64_t keyA, uint64_t keyB ) const;
+   void insertKey( uint64_t keyA, uint64_t keyB, int value );
+   void grow();
+   int findLinear( const int64_t* q, const int64_t* alternative ) const;
+
+private:
+   std::vector<Slot> _Slots;
+   std::vector<Entry> _Entries; // quantized matrices, for `findLinear`
+   int _Size = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "DataTypes.h"
+#include "Symmetry.h"
+
+#include <vector>
+#include <iterator>
+
+// non-owning view of base records [first, last) (stored in sector 0) seen from `sector`:
+// element i is `T( graph, first[i] ).premul( sector )`, made when dereferenced, so iterating allocates nothing
+template <class T, class Graph>
+class SectorRange
+{
+public:
+   class iterator
+   {
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = T;
+
+      iterator( const SectorRange* range, const GraphHandle* it ) : _Range( range ), _It( it ) {}
+      T operator*() const { return T( _Range->_Graph, *_It ).premul( _Range->_Sector ); }
+      iterator& operator++() { ++_It; return *this; }
+      bool operator==( const iterator& rhs ) const { return _It == rhs._It; }
+      bool operator!=( const iterator& rhs ) const { return _It != rhs._It; }
+
+   private:
+      const SectorRange* _Range;
+      const GraphHandle* _It;
+   };
+
+   SectorRange( const Graph* graph, const GraphHandle* first, const GraphHandle* last, const SectorId& sector ) : _Graph( graph ), _First( first ), _Last( last ), _Sector( sector ) {}
+   SectorRange( const Graph* graph, const std::vector<GraphHandle>& handles, const SectorId& sector ) : SectorRange( graph, handles.data(), handles.data() + handles.size(), sector ) {}
+
+   iterator begin() const { return iterator( this, _First ); }
+   iterator end() const { return iterator( this, _Last ); }
+   int size() const { return (int) ( _Last - _First ); }
+   bool empty() const { return _First == _Last; }
+   T operator[]( int i ) const { return T( _Graph, _First[i] ).premul( _Sector ); }
+   std::vector<T> toVector() const { return std::vector<T>( begin(), end() ); }
+
+private:
+   const Graph* _Graph;
+   const GraphHandle* _First;
+   const GraphHandle* _Last;
+   SectorId _Sector;
+};
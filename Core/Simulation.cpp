@@ -1,4 +1,5 @@
 #include "Simulation.h"
+#include "Timer.h"
 #include "trace.h"
 
 #include <set>
@@ -6,6 +7,34 @@
 
 using namespace std;
 
+namespace
+{
+   const double MIN_GAIN = 1e-4;
+   const double MAX_GAIN = 1.;
+   const double GAIN_GROW = 1.05;
+   const double GAIN_SHRINK = .5;
+   const int PLATEAU_WINDOW = 200;        // `runUntil` gives up if the error improved by less than PLATEAU_IMPROVEMENT over this many steps
+   const double PLATEAU_IMPROVEMENT = 1e-6;
+   const double LBFGS_FIRST_STEP = .01;   // max vertex displacement of the first (steepest descent) step
+   const int LBFGS_MAX_BACKTRACKS = 30;
+   const double ARMIJO = 1e-4;
+   const int FIRE_MIN_DOWNHILL = 5;         // downhill steps before the time step may grow
+   const double FIRE_DT_GROW = 1.1;
+   const double FIRE_DT_SHRINK = .5;
+   const double FIRE_MAX_DT = 10;            // relative to the initial time step sqrt( _Gain )
+   const double FIRE_ALPHA_START = .1;
+   const double FIRE_ALPHA_SHRINK = .99;
+   const double LM_INITIAL_LAMBDA = 1e-3;
+   const double LM_MIN_LAMBDA = 1e-12;
+   const double LM_MAX_LAMBDA = 1e12;
+   const double LM_LAMBDA_GROW = 4;
+   const double LM_LAMBDA_SHRINK = 1/3.;
+   const int LM_MAX_RETRIES = 30;
+   const int MIN_CHUNK_SIZE = 4096;          // fewer constraints per thread isn't worth the hand-off
+   const int FIXED_CHUNK_SIZE = 4096;        // chunk size for `_FixedReductionOrder`
+   const int MIN_PARALLEL_VERTICES = 4096;
+}
+
 void Simulation::init( std::shared_ptr<TileGraph> tileGraph )
 {
    _TileGraph = tileGraph;
@@ -13,6 +42,15 @@ void Simulation::init( std::shared_ptr<TileGraph> tileGraph )
    if ( _TileGraph )
    {
       _KeepCloseFars = _TileGraph->calcKeepCloseFars();
+      _Program.compile( *_TileGraph, _KeepCloseFars );
+      _AcceptedMerit = -1;
+      _Lbfgs.reset();
+      _LbfgsPos.clear();
+      _Lm.clear();
+      _Velocity.clear();
+      _ActiveSetPos.clear();
+      _BroadphasePos.clear();
+      _LmLambda = LM_INITIAL_LAMBDA;
       //_LineVertexConstraints = _Graph->calcLineVertexConstraints();
 
       _TileGraph->normalizeVertices();
@@ -41,34 +79,32 @@ double Simulation::step( double& paddingError )
 {   
    if ( !_TileGraph )
       return -1;
+   updateBroadphase();
+   _ActiveSetAge++; // once per step, however often the solver evaluates the constraints
+   if ( _Solver == LBFGS )
+      return stepLbfgs( paddingError );
+   if ( _Solver == LEVENBERG_MARQUARDT )
+      return stepLevenbergMarquardt( paddingError );
+   if ( _Solver == PROJECTION )
+      return stepProjection( paddingError );
    static bool s_printErrors = false;
    bool printErrors = s_printErrors && _PaddingError == 0;
    double totalError = 0;
    paddingError = 0;
    vector<XYZ> vel( _TileGraph->_Vertices.size() );
+   vector<XYZ> pos = positions();
 
-   for ( const TileGraph::KeepCloseFar& kcf : _KeepCloseFars )
-   {
-      XYZ a = kcf.a.pos();
-      XYZ b = kcf.b.pos();
-      double dist = a.dist( b );
+   totalError += accumulateConstraints( pos, vel, paddingError );
 
-      double pad = kcf.keepClose && kcf.keepFar ? 0 : _Padding;
-      if ( kcf.keepClose && dist >= 1.-pad )
-      {
-         vel[kcf.a.index()] += (kcf.a.matrix().inverted() * (b-a)) * (dist-(1-pad)) * .03;
-         vel[kcf.b.index()] += (kcf.b.matrix().inverted() * (a-b)) * (dist-(1-pad)) * .03;
-         totalError += max(0.,dist-1);
-         paddingError += dist-(1-pad);
-         if ( printErrors && !kcf.keepFar && dist-1 > 0 ) std::trace << "keep close " << kcf.a.id() << " " << kcf.b.id() << " " << dist-1 << std::endl;
-      }
-      if ( kcf.keepFar && dist <= 1.+pad )
+   if ( printErrors )
+   {
+      for ( const TileGraph::KeepCloseFar& kcf : _KeepCloseFars )
       {
-         vel[kcf.a.index()] += (kcf.a.matrix().inverted() * (a-b).normalized()) * ((1+pad)-dist) * .03;
-         vel[kcf.b.index()] += (kcf.b.matrix().inverted() * (b-a).normalized()) * ((1+pad)-dist) * .03;
-         totalError += max(0.,1-dist);
-         paddingError += (1+pad)-dist;
-         if ( printErrors && !kcf.keepClose && 1-dist > 0 ) std::trace << "keep far " << kcf.a.id() << " " << kcf.b.id() << " " << 1-dist << std::endl;
+         TileGraph::VertexPtr a = _TileGraph->vertex( kcf.a );
+         TileGraph::VertexPtr b = _TileGraph->vertex( kcf.b );
+         double dist = a.pos().dist( b.pos() );
+         if ( kcf.keepClose && !kcf.keepFar && dist-1 > 0 ) std::trace << "keep close " << a.id() << " " << b.id() << " " << dist-1 << std::endl;
+         if ( kcf.keepFar && !kcf.keepClose && 1-dist > 0 ) std::trace << "keep far " << a.id() << " " << b.id() << " " << 1-dist << std::endl;
       }
    }
    ////static bool s_dolvc = true;
@@ -146,20 +182,446 @@ double Simulation::step( double& paddingError )
 
       double d = vtx._Pos.len();
       double distError = _PerimeterRadius - d;
-      vel[vtx._Index] += (vtx._Pos/d) * distError * .03;
+      vel[vtx._Index] += (vtx._Pos/d) * distError * _Gain;
       totalError += distError;
    }
 
-   // apply velocities
-   for ( int i = 0; i < (int)vel.size(); i++ ) if ( !_TileGraph->_Vertices[i]._Symmetry->hasSymmetry() ) if ( i != _FixedVertex.index() )
+   if ( _Solver == FIRE )
+      fireStep( pos, vel );
+   else if ( _AdaptiveStep )
+      adaptStep( pos, vel, totalError + paddingError );
+
+   applyVelocities( vel );
+
+   if ( _Solver == FIRE )
+      _FirePos = positions();
+
+   if ( _Solver != FIRE && _AdaptiveStep )
+      for ( int i = 0; i < (int)pos.size(); i++ )
+         _ExpectedPos[i] = _TileGraph->_Vertices[i]._Pos;
+
+   return totalError;
+}
+
+// `merit` is the error at `pos`, and `vel` the step computed there
+// if the previous step raised the error, it is undone and `vel` is replaced by a shorter retry of it
+void Simulation::adaptStep( const vector<XYZ>& pos, vector<XYZ>& vel, double merit )
+{
+   bool isOutsideEdit = _ExpectedPos != pos;
+   _ExpectedPos.resize( pos.size() );
+
+   if ( !isOutsideEdit && _AcceptedMerit >= 0 && merit > _AcceptedMerit && _Gain > MIN_GAIN )
+   {
+      _Gain = max( _Gain * GAIN_SHRINK, MIN_GAIN );
+      for ( int i = 0; i < (int)pos.size(); i++ )
+      {
+         _TileGraph->_Vertices[i]._Pos = _AcceptedPos[i];
+         vel[i] = _AcceptedVel[i] * ( _Gain / _AcceptedGain );
+      }
+      return;
+   }
+
+   _AcceptedPos = pos;
+   _AcceptedVel = vel;
+   _AcceptedGain = _Gain;
+   _AcceptedMerit = merit;
+   _Gain = min( _Gain * GAIN_GROW, MAX_GAIN );
+}
+
+// `vel` is `_Gain` times the force on entry, the displacement of this step on exit
+// the velocity is mixed towards the force while going downhill, and zeroed as soon as it points uphill
+void Simulation::fireStep( const vector<XYZ>& pos, vector<XYZ>& vel )
+{
+   double dt0 = sqrt( _Gain );
+   if ( _Velocity.size() != pos.size() || _FirePos != pos )
    {
-      _TileGraph->_Vertices[i]._Pos += vel[i];
+      _Velocity.assign( pos.size(), XYZ() );
+      _FireDt = dt0;
+      _FireAlpha = FIRE_ALPHA_START;
+      _FireNumDownhill = 0;
    }
-   _TileGraph->normalizeVertices();
 
+   // forces and velocities are kept in the tangent plane, and at zero for vertices that can't move
+   double power = 0;
+   double vv = 0;
+   double ff = 0;
+   visitShape( *_TileGraph->_GraphShape, [&]( const auto& shape ) {
+      for ( int i = 0; i < (int)pos.size(); i++ )
+      {
+         if ( !isMovable( i ) )
+         {
+            vel[i] = _Velocity[i] = XYZ();
+            continue;
+         }
+         XYZ n = shape.normalAt( pos[i] );
+         vel[i] /= _Gain;
+         vel[i] -= n * ( vel[i] * n );
+         _Velocity[i] -= n * ( _Velocity[i] * n );
+         power += vel[i] * _Velocity[i];
+         vv += _Velocity[i].len2();
+         ff += vel[i].len2();
+      }
+   } );
+
+   // starting from rest (power and velocity both zero) counts as going downhill
+   if ( power > 0 || vv == 0 )
+   {
+      double mix = ff > 0 ? _FireAlpha * sqrt( vv / ff ) : 0.;
+      for ( int i = 0; i < (int)pos.size(); i++ )
+         _Velocity[i] = _Velocity[i] * ( 1 - _FireAlpha ) + vel[i] * mix;
+      if ( ++_FireNumDownhill > FIRE_MIN_DOWNHILL )
+      {
+         _FireDt = min( _FireDt * FIRE_DT_GROW, dt0 * FIRE_MAX_DT );
+         _FireAlpha *= FIRE_ALPHA_SHRINK;
+      }
+   }
+   else
+   {
+      for ( XYZ& v : _Velocity )
+         v = XYZ();
+      _FireDt *= FIRE_DT_SHRINK;
+      _FireAlpha = FIRE_ALPHA_START;
+      _FireNumDownhill = 0;
+   }
+
+   // semi-implicit Euler
+   for ( int i = 0; i < (int)pos.size(); i++ )
+   {
+      _Velocity[i] += vel[i] * _FireDt;
+      vel[i] = _Velocity[i] * _FireDt;
+   }
+}
+
+// pairs further apart than 1+_Padding+_BroadphaseMargin can't get within 1+_Padding (where keepFar becomes active)
+// before their ends have moved the margin between them, so until then the constraint set is exact
+void Simulation::updateBroadphase()
+{
+   if ( _BroadphaseMargin <= 0 )
+      return;
+
+   vector<XYZ> pos = positions();
+   bool rebuild = _BroadphasePos.size() != pos.size() || _BroadphasePadding != _Padding;
+   double maxMove2 = _BroadphaseMargin * _BroadphaseMargin / 4;
+   for ( int i = 0; i < (int)pos.size() && !rebuild; i++ )
+      rebuild = pos[i].dist2( _BroadphasePos[i] ) > maxMove2;
+   if ( !rebuild )
+      return;
+
+   _KeepCloseFars = _TileGraph->calcKeepCloseFarsNear( 1 + _Padding + _BroadphaseMargin );
+   _Program.compile( *_TileGraph, _KeepCloseFars );
+   _BroadphasePos = pos;
+   _BroadphasePadding = _Padding;
+
+   // everything built from the old constraint set
+   _ActiveSetPos.clear();
+   _Lm.clear();
+   _Lbfgs.reset();
+   _LbfgsPos.clear();
+}
+
+// `_Program`, or the part of it that can be active at `pos`
+// the skipped constraints were more than `_ActiveSetSkin` outside their band when the set was built,
+// so they stay inactive until the two ends of one have moved `_ActiveSetSkin` between them
+ConstraintProgram& Simulation::activeProgram( const vector<XYZ>& pos )
+{
+   if ( _ActiveSetSkin <= 0 )
+      return _Program;
+
+   bool rebuild = _ActiveSetPos.size() != pos.size() || _ActiveSetPadding != _Padding || _ActiveSetBuiltSkin != _ActiveSetSkin || _ActiveSetAge >= _ActiveSetInterval;
+   double maxMove2 = _ActiveSetSkin * _ActiveSetSkin / 4;
+   for ( int i = 0; i < (int)pos.size() && !rebuild; i++ )
+      rebuild = pos[i].dist2( _ActiveSetPos[i] ) > maxMove2;
+   if ( rebuild )
+   {
+      _Program.selectActive( pos, _Padding, _ActiveSetSkin, _ActiveProgram );
+      _ActiveSetPos = pos;
+      _ActiveSetPadding = _Padding;
+      _ActiveSetBuiltSkin = _ActiveSetSkin;
+      _ActiveSetAge = 0;
+   }
+   return _ActiveProgram;
+}
+
+double Simulation::accumulateConstraints( const vector<XYZ>& pos, vector<XYZ>& vel, double& paddingError )
+{
+   ConstraintProgram& program = activeProgram( pos );
+   int n = program.size();
+   int numChunks = _FixedReductionOrder ? ( n + FIXED_CHUNK_SIZE-1 ) / FIXED_CHUNK_SIZE : min( numThreads(), n / MIN_CHUNK_SIZE );
+   if ( numChunks <= 1 )
+      return program.accumulate( pos, _Padding, _Gain, vel, paddingError );
+
+   // each chunk accumulates into its own buffer, then the buffers are summed in chunk order
+   _ChunkVel.resize( numChunks );
+   _ChunkError.assign( numChunks, 0. );
+   _ChunkPaddingError.assign( numChunks, 0. );
+   runTasks( numChunks, [&]( int chunk ) {
+      int begin = (int) ( (int64_t) n * chunk / numChunks );
+      int end = (int) ( (int64_t) n * (chunk+1) / numChunks );
+      _ChunkVel[chunk].assign( pos.size(), XYZ() );
+      _ChunkError[chunk] = program.accumulate( begin, end, pos, _Padding, _Gain, _ChunkVel[chunk], _ChunkPaddingError[chunk] );
+   } );
+
+   parallelFor( (int) vel.size(), [&]( int begin, int end ) {
+      for ( int chunk = 0; chunk < numChunks; chunk++ )
+         for ( int i = begin; i < end; i++ )
+            vel[i] += _ChunkVel[chunk][i];
+   } );
+
+   double totalError = 0;
+   for ( int chunk = 0; chunk < numChunks; chunk++ )
+   {
+      totalError += _ChunkError[chunk];
+      paddingError += _ChunkPaddingError[chunk];
+   }
    return totalError;
 }
 
+void Simulation::applyVelocities( const vector<XYZ>& vel )
+{
+   visitShape( *_TileGraph->_GraphShape, [&]( const auto& shape ) {
+      parallelFor( (int) vel.size(), [&]( int begin, int end ) {
+         for ( int i = begin; i < end; i++ )
+         {
+            TileGraph::Vertex& vtx = _TileGraph->_Vertices[i];
+            if ( isMovable( i ) )
+               vtx._Pos += vel[i];
+            vtx._Pos = shape.toSurfaceFrom3D( vtx._Pos );
+         }
+      } );
+   } );
+}
+
+vector<XYZ> Simulation::positions() const
+{
+   vector<XYZ> ret( _TileGraph->_Vertices.size() );
+   for ( int i = 0; i < (int)ret.size(); i++ )
+      ret[i] = _TileGraph->_Vertices[i]._Pos;
+   return ret;
+}
+
+vector<bool> Simulation::movableVertices() const
+{
+   vector<bool> ret( _TileGraph->_Vertices.size() );
+   for ( int i = 0; i < (int)ret.size(); i++ )
+      ret[i] = isMovable( i );
+   return ret;
+}
+
+// penalty energy of the constraints and the perimeter at `pos`
+// `grad` is projected onto the surface, and is zero for vertices that can't move
+double Simulation::energy( const vector<XYZ>& pos, vector<XYZ>& grad, double& totalError, double& paddingError )
+{
+   grad.assign( pos.size(), XYZ() );
+   ConstraintProgram& program = activeProgram( pos );
+   double ret = program.energy( 0, program.size(), pos, _Padding, grad, totalError, paddingError );
+
+   for ( const TileGraph::Vertex& vtx : _TileGraph->_Vertices ) if ( vtx._OnPerimeter )
+   {
+      const XYZ& p = pos[vtx._Index];
+      if ( p.len2() > _PerimeterRadius*_PerimeterRadius )
+         continue;
+
+      double d = p.len();
+      double distError = _PerimeterRadius - d;
+      ret += distError * distError * .5;
+      grad[vtx._Index] -= (p/d) * distError;
+      totalError += distError;
+   }
+
+   visitShape( *_TileGraph->_GraphShape, [&]( const auto& shape ) {
+      for ( int i = 0; i < (int)pos.size(); i++ )
+      {
+         if ( !isMovable( i ) )
+         {
+            grad[i] = XYZ();
+            continue;
+         }
+         XYZ n = shape.normalAt( pos[i] );
+         grad[i] -= n * ( grad[i] * n );
+      }
+   } );
+   return ret;
+}
+
+double Simulation::stepLbfgs( double& paddingError )
+{
+   double totalError = 0;
+   paddingError = 0;
+   vector<XYZ> pos = positions();
+   vector<XYZ> grad;
+   double e0 = energy( pos, grad, totalError, paddingError );
+
+   if ( pos != _LbfgsPos )
+      _Lbfgs.reset();
+
+   vector<XYZ> dir = _Lbfgs.direction( grad );
+   double slope = Lbfgs::dot( grad, dir );
+   if ( !( slope < 0 ) ) // not a descent direction:  fall back to steepest descent
+   {
+      _Lbfgs.reset();
+      dir = _Lbfgs.direction( grad );
+      slope = Lbfgs::dot( grad, dir );
+   }
+   if ( slope == 0 )
+      return totalError;
+
+   double t = 1;
+   if ( _Lbfgs.isEmpty() )
+   {
+      double maxLen2 = 0;
+      for ( const XYZ& v : dir )
+         maxLen2 = max( maxLen2, v.len2() );
+      t = min( 1., LBFGS_FIRST_STEP / sqrt( maxLen2 ) );
+   }
+
+   vector<XYZ> trial( pos.size() );
+   vector<XYZ> trialGrad;
+   for ( int iter = 0; iter < LBFGS_MAX_BACKTRACKS; iter++, t *= .5 )
+   {
+      visitShape( *_TileGraph->_GraphShape, [&]( const auto& shape ) {
+         for ( int i = 0; i < (int)pos.size(); i++ )
+            trial[i] = isMovable( i ) ? shape.toSurfaceFrom3D( pos[i] + dir[i] * t ) : pos[i];
+      } );
+
+      double trialError = 0;
+      double trialPaddingError = 0;
+      double e1 = energy( trial, trialGrad, trialError, trialPaddingError );
+      if ( e1 > e0 + ARMIJO * t * slope )
+         continue;
+
+      vector<XYZ> s( pos.size() );
+      vector<XYZ> y( pos.size() );
+      for ( int i = 0; i < (int)pos.size(); i++ )
+      {
+         s[i] = trial[i] - pos[i];
+         y[i] = trialGrad[i] - grad[i];
+         _TileGraph->_Vertices[i]._Pos = trial[i];
+      }
+      _Lbfgs.update( s, y );
+      _LbfgsPos = trial;
+      return totalError;
+   }
+
+   // no sufficient decrease along `dir`, start over from steepest descent
+   _Lbfgs.reset();
+   _LbfgsPos.clear();
+   return totalError;
+}
+
+double Simulation::stepLevenbergMarquardt( double& paddingError )
+{
+   double totalError = 0;
+   paddingError = 0;
+   vector<XYZ> pos = positions();
+   vector<XYZ> grad;
+   double e0 = energy( pos, grad, totalError, paddingError );
+   if ( e0 == 0 )
+      return totalError;
+
+   vector<bool> movable = movableVertices();
+   if ( !_Lm.isCompiled( movable ) )
+      _Lm.compile( *_TileGraph, _Program, movable );
+   _Lm.linearize( _Program, *_TileGraph, pos, _Padding, _PerimeterRadius );
+
+   vector<XYZ> delta;
+   vector<XYZ> trial( pos.size() );
+   for ( int iter = 0; iter < LM_MAX_RETRIES; iter++, _LmLambda = min( LM_MAX_LAMBDA, _LmLambda * LM_LAMBDA_GROW ) )
+   {
+      _Lm.solve( _LmLambda, delta );
+      visitShape( *_TileGraph->_GraphShape, [&]( const auto& shape ) {
+         for ( int i = 0; i < (int)pos.size(); i++ )
+            trial[i] = movable[i] ? shape.toSurfaceFrom3D( pos[i] + delta[i] ) : pos[i];
+      } );
+
+      double trialError = 0;
+      double trialPaddingError = 0;
+      if ( !( energy( trial, grad, trialError, trialPaddingError ) < e0 ) )
+         continue;
+
+      for ( int i = 0; i < (int)pos.size(); i++ )
+         _TileGraph->_Vertices[i]._Pos = trial[i];
+      _LmLambda = max( LM_MIN_LAMBDA, _LmLambda * LM_LAMBDA_SHRINK );
+      break;
+   }
+   return totalError;
+}
+
+double Simulation::stepProjection( double& paddingError )
+{
+   vector<bool> movable = movableVertices();
+   if ( !_Program.isColorized( movable ) )
+      _Program.colorize( movable );
+
+   double totalError = 0;
+   paddingError = 0;
+   vector<XYZ> pos = positions();
+   const IGraphShape& shape = *_TileGraph->_GraphShape;
+   for ( int color = 0; color < _Program.numColors(); color++ )
+   {
+      // the constraints of one color share no movable vertex, so its chunks can't race.  the split only decides the order the errors are summed in
+      int colorBegin = _Program._ColorStart[color];
+      int n = _Program._ColorStart[color+1] - colorBegin;
+      int numChunks = _FixedReductionOrder ? ( n + FIXED_CHUNK_SIZE-1 ) / FIXED_CHUNK_SIZE : min( numThreads(), n / MIN_CHUNK_SIZE );
+      if ( numChunks <= 1 )
+      {
+         totalError += _Program.project( colorBegin, colorBegin + n, pos, _Padding, shape, paddingError );
+         continue;
+      }
+
+      _ChunkError.assign( numChunks, 0. );
+      _ChunkPaddingError.assign( numChunks, 0. );
+      runTasks( numChunks, [&]( int chunk ) {
+         int begin = colorBegin + (int) ( (int64_t) n * chunk / numChunks );
+         int end = colorBegin + (int) ( (int64_t) n * (chunk+1) / numChunks );
+         _ChunkError[chunk] = _Program.project( begin, end, pos, _Padding, shape, _ChunkPaddingError[chunk] );
+      } );
+      for ( int chunk = 0; chunk < numChunks; chunk++ )
+      {
+         totalError += _ChunkError[chunk];
+         paddingError += _ChunkPaddingError[chunk];
+      }
+   }
+
+   // perimeter
+   for ( const TileGraph::Vertex& vtx : _TileGraph->_Vertices ) if ( vtx._OnPerimeter )
+   {
+      XYZ& p = pos[vtx._Index];
+      if ( p.len2() > _PerimeterRadius*_PerimeterRadius )
+         continue;
+
+      double d = p.len();
+      totalError += _PerimeterRadius - d;
+      if ( movable[vtx._Index] )
+         p = shape.toSurfaceFrom3D( p * ( _PerimeterRadius / d ) );
+   }
+
+   for ( int i = 0; i < (int)pos.size(); i++ )
+      _TileGraph->_Vertices[i]._Pos = pos[i];
+   return totalError;
+}
+
+void Simulation::setNumThreads( int numThreads )
+{
+   if ( numThreads == this->numThreads() )
+      return;
+   _ThreadPool = numThreads > 1 ? std::shared_ptr<ThreadPool>( new ThreadPool( numThreads ) ) : nullptr;
+}
+
+void Simulation::runTasks( int numTasks, const std::function<void(int)>& func )
+{
+   if ( _ThreadPool )
+      return _ThreadPool->run( numTasks, func );
+   for ( int i = 0; i < numTasks; i++ )
+      func( i );
+}
+
+void Simulation::parallelFor( int n, const std::function<void(int,int)>& func )
+{
+   if ( _ThreadPool && n >= MIN_PARALLEL_VERTICES )
+      return _ThreadPool->parallelFor( n, func );
+   func( 0, n );
+}
+
 double Simulation::step( int numSteps )
 {
    double tot = 0;
@@ -175,6 +637,40 @@ double Simulation::step( int numSteps )
    return tot / numSteps;
 }
 
+Simulation::RunResult Simulation::runUntil( double tolerance, int maxSteps, double maxSeconds )
+{
+   RunResult ret;
+   if ( !_TileGraph )
+      return ret;
+
+   Timer timer;
+   double windowStartMerit = -1;
+   for ( ret.numSteps = 0; ret.numSteps < maxSteps; )
+   {
+      ret.error = step( ret.paddingError );
+      ret.numSteps++;
+      _PaddingError = ret.paddingError;
+
+      if ( ret.error <= tolerance && ret.paddingError <= tolerance )
+      {
+         ret.converged = true;
+         break;
+      }
+
+      double merit = ret.error + ret.paddingError;
+      if ( ret.numSteps % PLATEAU_WINDOW == 1 )
+      {
+         if ( windowStartMerit >= 0 && windowStartMerit - merit <= windowStartMerit * PLATEAU_IMPROVEMENT )
+            break;
+         windowStartMerit = merit;
+      }
+
+      if ( timer.ElapsedTime() >= maxSeconds )
+         break;
+   }
+   return ret;
+}
+
 void Simulation::moveDualVerticesToCentroid()
 {
    if ( !_TileGraph )
@@ -183,8 +679,8 @@ void Simulation::moveDualVerticesToCentroid()
    for ( const TileGraph::Tile& tile : _TileGraph->_Tiles )
    {
       std::vector<XYZ> v;
-      for ( const TileGraph::VertexPtr& vtx : tile._Vertices )
-         v.push_back( vtx.pos() );
+      for ( const GraphHandle& vtx : tile._Vertices )
+         v.push_back( _TileGraph->vertex( vtx ).pos() );
       _DualGraph->_Vertices[tile._Index].pos = centroid( v );
    }
 }
\ No newline at end of file
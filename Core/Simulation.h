@@ -2,27 +2,117 @@
 
 #include "TileGraph.h"
 #include "DualGraph.h"
+#include "ConstraintProgram.h"
+#include "ThreadPool.h"
+#include "Lbfgs.h"
+#include "LevenbergMarquardt.h"
 
 class Simulation
 {
 public:
+   enum Solver
+   {
+      GRADIENT_DESCENT, // each constraint pushes its endpoints by `_Gain` times its error
+      LBFGS,            // quasi-Newton minimization of the penalty energy, with a backtracking line search
+      LEVENBERG_MARQUARDT, // damped Gauss-Newton on the violated constraints, converges in a few iterations once rigid edges are nearly right
+      PROJECTION,       // moves the ends of each violated constraint onto its distance band, Gauss-Seidel over color classes
+      FIRE,             // damped dynamics (fast inertial relaxation engine):  the gradient descent forces accelerate a persistent velocity
+   };
+
+   struct RunResult
+   {
+      double error = -1;
+      double paddingError = 0;
+      int numSteps = 0;
+      bool converged = false; // error and padding error are both below the tolerance
+   };
+
    CORE_API void init( std::shared_ptr<TileGraph> graph );
    CORE_API void normalizeVertices();
    CORE_API double step( double& paddingError );
    CORE_API double step( int numSteps );
+   // steps until the error and padding error are below `tolerance`, stop improving, or a limit is reached.
+   // the result and `_PaddingError` hold the last step's errors, unlike `step( numSteps )` which averages them over its steps
+   CORE_API RunResult runUntil( double tolerance, int maxSteps, double maxSeconds );
    CORE_API void setRadius( double radius );   
    CORE_API void moveDualVerticesToCentroid();
+   CORE_API void setNumThreads( int numThreads );
+   CORE_API int numThreads() const { return _ThreadPool ? _ThreadPool->numThreads() : 1; }
+
+private:
+   void updateBroadphase();
+   ConstraintProgram& activeProgram( const std::vector<XYZ>& pos );
+   double accumulateConstraints( const std::vector<XYZ>& pos, std::vector<XYZ>& vel, double& paddingError );
+   void adaptStep( const std::vector<XYZ>& pos, std::vector<XYZ>& vel, double merit );
+   double stepLbfgs( double& paddingError );
+   double stepLevenbergMarquardt( double& paddingError );
+   double stepProjection( double& paddingError );
+   void fireStep( const std::vector<XYZ>& pos, std::vector<XYZ>& vel );
+   double energy( const std::vector<XYZ>& pos, std::vector<XYZ>& grad, double& totalError, double& paddingError );
+   bool isMovable( int index ) const { return !_TileGraph->_Vertices[index]._Symmetry->hasSymmetry() && index != _FixedVertex.index(); }
+   std::vector<XYZ> positions() const;
+   std::vector<bool> movableVertices() const;
+   void applyVelocities( const std::vector<XYZ>& vel );
+   void runTasks( int numTasks, const std::function<void(int)>& func );
+   void parallelFor( int n, const std::function<void(int,int)>& func );
 
 public:
    double _Radius = 1;
    double _Padding = .0000;
    double _PaddingError = 0;
    double _PerimeterRadius = 0;
+   Solver _Solver = GRADIENT_DESCENT;
+   double _Gain = .03;
+   bool _AdaptiveStep = false; // grow `_Gain` while the error drops, undo the step and shrink it when the error rises
    TileGraph::VertexPtr _FixedVertex;
    std::shared_ptr<TileGraph> _TileGraph;
    std::shared_ptr<DualGraph> _DualGraph;
    std::vector<TileGraph::KeepCloseFar> _KeepCloseFars;
+   ConstraintProgram _Program; // compiled from `_KeepCloseFars` in `init`, and again by `updateBroadphase`
+   double _BroadphaseMargin = 0; // > 0: `_KeepCloseFars` = calcKeepCloseFarsNear( 1+_Padding+margin ), rebuilt once some vertex moved margin/2.  0 = calcKeepCloseFars once
+   double _ActiveSetSkin = 0;    // > 0: constraints further than this outside their band are skipped, until some vertex moved skin/2.  0 = evaluate all every step
+   int _ActiveSetInterval = 100; // steps between re-checks of the skipped constraints regardless
    std::vector<TileGraph::LineVertexConstraint> _LineVertexConstraints;
-   std::pair<int, int> _ShowDistanceVertices = {-1,-1};
+   std::pair<int64_t, int64_t> _ShowDistanceVertices = {-1,-1};
+   bool _FixedReductionOrder = false; // split constraints independently of the thread count, so results are bit-identical for any thread count
+   std::shared_ptr<ThreadPool> _ThreadPool;
+
+private: // scratch
+   std::vector<std::vector<XYZ>> _ChunkVel;
+   std::vector<double> _ChunkError;
+   std::vector<double> _ChunkPaddingError;
+
+private: // broadphase state
+   std::vector<XYZ> _BroadphasePos; // positions when `_KeepCloseFars` was built from geometry
+   double _BroadphasePadding = 0;
+
+private: // active set state
+   ConstraintProgram _ActiveProgram; // the constraints of `_Program` near their band at `_ActiveSetPos`
+   std::vector<XYZ> _ActiveSetPos;
+   double _ActiveSetPadding = 0;
+   double _ActiveSetBuiltSkin = 0;
+   int _ActiveSetAge = 0; // steps since the set was built
+
+private: // adaptive step state
+   std::vector<XYZ> _AcceptedPos;  // positions at the last accepted step
+   std::vector<XYZ> _AcceptedVel;  // velocities computed at `_AcceptedPos`, scaled by `_AcceptedGain`
+   std::vector<XYZ> _ExpectedPos;  // positions after the last step, to detect outside edits (e.g. dragging a vertex)
+   double _AcceptedGain = 0;
+   double _AcceptedMerit = -1;
+
+private: // LBFGS state
+   Lbfgs _Lbfgs;
+   std::vector<XYZ> _LbfgsPos;     // positions after the last step, history is dropped if they were edited since
+
+private: // FIRE state
+   std::vector<XYZ> _Velocity;     // per vertex, in its base frame
+   std::vector<XYZ> _FirePos;      // positions after the last step, the velocity is dropped if they were edited since
+   double _FireDt = 0;
+   double _FireAlpha = 0;
+   int _FireNumDownhill = 0;
+
+private: // LEVENBERG_MARQUARDT state
+   LevenbergMarquardt _Lm;         // recompiled when the set of movable vertices changes
+   double _LmLambda = 1e-3;
 };
 
@@ -0,0 +1,32 @@
+#include "SpatialHash.h"
+
+#include <cmath>
+
+uint64_t SpatialHash::key( int64_t x, int64_t y, int64_t z )
+{
+   // 21 bits per coordinate
+   const uint64_t MASK = ( 1ull << 21 ) - 1;
+   return ( (uint64_t) x & MASK ) | ( ( (uint64_t) y & MASK ) << 21 ) | ( ( (uint64_t) z & MASK ) << 42 );
+}
+
+void SpatialHash::insert( const XYZ& p, int value )
+{
+   _Cells[key( cellCoord( p.x ), cellCoord( p.y ), cellCoord( p.z ) )].push_back( value );
+}
+
+void SpatialHash::forEachNear( const XYZ& p, const std::function<void(int)>& func ) const
+{
+   int64_t cx = cellCoord( p.x );
+   int64_t cy = cellCoord( p.y );
+   int64_t cz = cellCoord( p.z );
+   for ( int64_t x = cx-1; x <= cx+1; x++ )
+      for ( int64_t y = cy-1; y <= cy+1; y++ )
+         for ( int64_t z = cz-1; z <= cz+1; z++ )
+         {
+            auto it = _Cells.find( key( x, y, z ) );
+            if ( it == _Cells.end() )
+               continue;
+            for ( int value : it->second )
+               func( value );
+         }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "DataTypes.h"
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+// uniform grid of cubic cells, with only the non-empty cells stored (in a hash map)
+class SpatialHash
+{
+public:
+   SpatialHash( double cellSize ) : _CellSize( cellSize ) {}
+
+   void insert( const XYZ& p, int value );
+
+   // calls `func( value )` for every point in the 3x3x3 cells around `p`, which covers every point within the cell size
+   void forEachNear( const XYZ& p, const std::function<void(int)>& func ) const;
+
+private:
+   int64_t cellCoord( double x ) const { return (int64_t) floor( x / _CellSize ); }
+   static uint64_t key( int64_t x, int64_t y, int64_t z );
+
+private:
+   double _CellSize;
+   std::unordered_map<uint64_t, std::vector<int>> _Cells;
+};
@@ -3,6 +3,12 @@
 #include <cassert>
 #include <set>
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
 
 void SymmetryGroup::init( int visibleLoIndexHint, int visibleHiIndexHint )
 {
@@ -29,6 +35,18 @@ void SymmetryGroup::init( int visibleLoIndexHint, int visibleHiIndexHint )
       _VisibleHiIndex = _HiIndex = groupSize;
       assert( _ColorPerm.pow( groupSize ).isIdentity() ); // make sure color group permutation is valid
    }
+   initPowers();
+}
+
+void SymmetryGroup::initPowers()
+{
+   _MatrixPowers.clear();
+   _ColorPermPowers.clear();
+   for ( int i = _LoIndex; i < _HiIndex; i++ )
+   {
+      _MatrixPowers.push_back( _Matrix.pow( i ) );
+      _ColorPermPowers.push_back( _ColorPerm.pow( i ) );
+   }
 }
 
 Json SymmetryGroup::toJson() const
@@ -53,27 +71,40 @@ SymmetryGroup::SymmetryGroup( const Json& json )
    _VisibleLoIndex   = json["visibleLoIndex"].toInt();
    _VisibleHiIndex   = json["visibleHiIndex"].toInt();
    _IsFinite         = json["isFinite"].toBool();
+   initPowers();
 }
 
 GraphSymmetry_Groups::GraphSymmetry_Groups( const std::vector<SymmetryGroup>& groups ) : _Groups( groups )
 {
+   _Tables = &_SectorTables;
    int N = (int) _Groups.size();
    {
       std::vector<int> groupIndexes = { std::vector<int>( N, -1 ) };
       initAllSectorGroupIndexes( 0, groupIndexes );
    }
 
-   for ( int sectorId = 0; sectorId < (int)_AllSectorGroupIndexes.size(); sectorId++ )
+   int numSectors = (int)_AllSectorGroupIndexes.size();
+   _SectorTables.numSectors = numSectors;
+   std::string key = tablesKey();
+   bool isCached = loadTables( key );
+
+   for ( int sectorId = 0; sectorId < numSectors; sectorId++ )
    {
       Matrix4x4 m;
-      for ( int i = 0; i < N; i++ )
-         m = m * _Groups[i].matrix( _AllSectorGroupIndexes[sectorId][i] );
+      if ( isCached )
+         m = _SectorTables.matrix[sectorId];
+      else
+      {
+         for ( int i = 0; i < N; i++ )
+            m = m * _Groups[i].matrix( _AllSectorGroupIndexes[sectorId][i] );
+         _SectorTables.matrix.push_back( m );
+      }
 
-      uint64_t hash = matrixHash( m );
-      assert( !_SectorHashToId.count( hash ) );
-      _SectorHashToId[hash] = sectorId;
+      assert( _SectorIndex.find( m ) < 0 );
+      _SectorIndex.insert( m, sectorId );
 
-      _SectorIdToMatrix.push_back( m );
+      _SectorTables.transform.push_back( RigidTransform( m ) );
+      _SectorTables.inverse.push_back( _SectorTables.transform.back().inverted() );
       _AllSectors.push_back( SectorId( sectorId, this ) );
    }
 
@@ -84,6 +115,13 @@ GraphSymmetry_Groups::GraphSymmetry_Groups( const std::vector<SymmetryGroup>& gr
          perm = _Groups[i].colorPerm( _AllSectorGroupIndexes[sectorId][i] ) * perm;
 
       _SectorIdToColorPerm.push_back( perm );
+
+      Perm inverse = perm.inverted();
+      for ( int color = 0; color < SectorTables::COLOR_STRIDE; color++ )
+      {
+         _SectorTables.colorMap.push_back( (uint8_t) perm[color] );
+         _SectorTables.colorUnmap.push_back( (uint8_t) inverse[color] );
+      }
    }
 
    for ( int sectorId = 0; sectorId < (int)_AllSectorGroupIndexes.size(); sectorId++ )
@@ -109,17 +147,156 @@ GraphSymmetry_Groups::GraphSymmetry_Groups( const std::vector<SymmetryGroup>& gr
       _SectorIdIsVisible.push_back( isVisible );
    }
 
-   for ( int sectorId = 0; sectorId < (int)_AllSectorGroupIndexes.size(); sectorId++ )
+   if ( isCached )
+      return;
+
+   for ( int sectorId = 0; sectorId < numSectors; sectorId++ )
+   {
+      _SectorTables.invert.push_back( this->sectorId( _SectorTables.inverse[sectorId].toMatrix() ) );
+   }
+
+   _SectorTables.mul.reserve( numSectors * numSectors );
+   for ( int a = 0; a < numSectors; a++ )
+   for ( int b = 0; b < numSectors; b++ )
+   {
+      _SectorTables.mul.push_back( sectorId( matrix( a ) * matrix( b ) ) );
+   }
+
+   saveTables( key );
+}
+
+namespace
+{
+   const char TABLES_MAGIC[8] = { 'H', 'N', 'S', 'Y', 'M', 'T', 'A', 'B' };
+   const uint32_t TABLES_VERSION = 2;
+
+   // file layout, all native-endian and fixed-size so the file can be mapped as is:
+   //    header, key[keySize] (zero padded to a multiple of 8), matrix[numSectors] (16 doubles each, column-major), invert[numSectors], mul[numSectors^2]
+   struct TablesHeader
+   {
+      char     magic[8];
+      uint32_t version;
+      uint32_t numSectors;
+      uint32_t keySize;
+      uint32_t reserved = 0;
+   };
+
+   size_t paddedKeySize( const std::string& key ) { return ( key.size() + 7 ) / 8 * 8; }
+
+   std::string& tablesCacheDirectory()
+   {
+      static std::string s_dir;
+      return s_dir;
+   }
+
+   // FNV-1a
+   void hashBytes( uint64_t& h, const void* data, size_t size )
    {
-      _Invert.push_back( this->sectorId( matrix( sectorId ).inverted() ) );
+      for ( size_t i = 0; i < size; i++ )
+      {
+         h ^= ( (const uint8_t*) data )[i];
+         h *= 0x100000001b3ULL;
+      }
    }
+}
+
+void GraphSymmetry_Groups::setCacheDirectory( const std::string& dir )
+{
+   tablesCacheDirectory() = dir;
+}
 
-   _Mul.resize( (int)_AllSectorGroupIndexes.size() );
-   for ( int a = 0; a < (int)_AllSectorGroupIndexes.size(); a++ )
-   for ( int b = 0; b < (int)_AllSectorGroupIndexes.size(); b++ )
+// everything the tables are built from:  the format version, and each group's generator, color perm and index ranges.
+// Stored in the file and compared in full, its hash only names the file
+std::string GraphSymmetry_Groups::tablesKey() const
+{
+   std::string ret( (const char*) &TABLES_VERSION, sizeof( TABLES_VERSION ) );
+   for ( const SymmetryGroup& g : _Groups )
    {
-      _Mul[a].push_back( sectorId( matrix( a ) * matrix( b ) ) );
+      Matrix4x4 m = g.matrix( 1 );
+      Perm perm = g.colorPerm( 1 );
+      int32_t indexes[5] = { g.loIndex(), g.hiIndex(), g.visibleLoIndex(), g.visibleHiIndex(), g.isFinite() };
+      ret.append( (const char*) m.m, sizeof( m.m ) );
+      ret.append( (const char*) perm.v, sizeof( perm.v ) );
+      ret.append( (const char*) indexes, sizeof( indexes ) );
    }
+   return ret;
+}
+
+std::string GraphSymmetry_Groups::tablesPath( const std::string& key ) const
+{
+   uint64_t h = 0xcbf29ce484222325ULL;
+   hashBytes( h, key.data(), key.size() );
+   char name[32];
+   snprintf( name, sizeof( name ), "sym_%016llx.bin", (unsigned long long) h );
+   return tablesCacheDirectory() + "/" + name;
+}
+
+bool GraphSymmetry_Groups::loadTables( const std::string& key )
+{
+   if ( tablesCacheDirectory().empty() )
+      return false;
+   std::ifstream in( tablesPath( key ), std::ios::binary );
+   if ( !in )
+      return false;
+
+   int numSectors = _SectorTables.numSectors;
+   TablesHeader header;
+   in.read( (char*) &header, sizeof( header ) );
+   if ( !in || memcmp( header.magic, TABLES_MAGIC, sizeof( TABLES_MAGIC ) ) || header.version != TABLES_VERSION || header.keySize != key.size() || (int) header.numSectors != numSectors )
+      return false;
+   std::string fileKey( paddedKeySize( key ), '\0' );
+   in.read( &fileKey[0], fileKey.size() );
+   if ( !in || fileKey.compare( 0, key.size(), key ) != 0 ) // a hash collision, or a stale file
+      return false;
+
+   _SectorTables.matrix.resize( numSectors );
+   _SectorTables.invert.resize( numSectors );
+   _SectorTables.mul.resize( (size_t) numSectors * numSectors );
+   in.read( (char*) _SectorTables.matrix.data(), numSectors * sizeof( Matrix4x4 ) );
+   in.read( (char*) _SectorTables.invert.data(), numSectors * sizeof( int32_t ) );
+   in.read( (char*) _SectorTables.mul.data(), _SectorTables.mul.size() * sizeof( int32_t ) );
+   if ( in )
+      return true;
+
+   _SectorTables.matrix.clear();
+   _SectorTables.invert.clear();
+   _SectorTables.mul.clear();
+   return false;
+}
+
+void GraphSymmetry_Groups::saveTables( const std::string& key ) const
+{
+   if ( tablesCacheDirectory().empty() )
+      return;
+
+   // written under a temporary name and renamed, so that concurrent runs never read a partial file.
+   // the name is random, the same object address can come up in two processes
+   std::string path = tablesPath( key );
+   std::random_device random;
+   std::string tmpPath = path + "." + std::to_string( ( (uint64_t) random() << 32 ) | random() ) + ".tmp";
+   {
+      std::ofstream out( tmpPath, std::ios::binary );
+      TablesHeader header;
+      memcpy( header.magic, TABLES_MAGIC, sizeof( TABLES_MAGIC ) );
+      header.version = TABLES_VERSION;
+      header.numSectors = (uint32_t) _SectorTables.numSectors;
+      header.keySize = (uint32_t) key.size();
+      std::string paddedKey = key;
+      paddedKey.resize( paddedKeySize( key ), '\0' );
+      out.write( (const char*) &header, sizeof( header ) );
+      out.write( paddedKey.data(), paddedKey.size() );
+      out.write( (const char*) _SectorTables.matrix.data(), _SectorTables.matrix.size() * sizeof( Matrix4x4 ) );
+      out.write( (const char*) _SectorTables.invert.data(), _SectorTables.invert.size() * sizeof( int32_t ) );
+      out.write( (const char*) _SectorTables.mul.data(), _SectorTables.mul.size() * sizeof( int32_t ) );
+      if ( !out )
+      {
+         out.close();
+         std::remove( tmpPath.c_str() );
+         return;
+      }
+   }
+   if ( std::rename( tmpPath.c_str(), path.c_str() ) != 0 )
+      std::remove( tmpPath.c_str() ); // another run got there first
 }
 
 void GraphSymmetry_Groups::initAllSectorGroupIndexes( int i, std::vector<int>& groupIndexes )
@@ -149,8 +326,394 @@ Json GraphSymmetry_Groups::toJson() const
    return ret;
 }
 
+GraphSymmetry_Closure::GraphSymmetry_Closure( const std::vector<Generator>& generators ) : _Generators( generators )
+{
+   init();
+}
+
+GraphSymmetry_Closure::GraphSymmetry_Closure( const Json& json )
+{
+   for ( const Json& e : json["generators"].toArray() )
+      _Generators.push_back( { Matrix4x4( e["matrix"] ), Perm( e["colorPerm"] ) } );
+   init();
+}
+
+void GraphSymmetry_Closure::init()
+{
+   const int MAX_SECTORS = 10000; // the generators don't generate a finite group
+   _Tables = &_SectorTables;
+
+   // breadth first over right multiplication by the generators, so each sector's parent has a lower id
+   std::vector<Matrix4x4>& matrices = _SectorTables.matrix;
+   std::vector<int> parent = { -1 };
+   std::vector<int> parentGenerator = { -1 };
+   std::vector<std::vector<int>> times = {}; // times[sectorId][generator]
+   matrices.push_back( Matrix4x4() );
+   _SectorIdToColorPerm.push_back( Perm() );
+   _SectorIdToName.push_back( "" );
+   _SectorIndex.insert( Matrix4x4(), 0 );
+   for ( int sectorId = 0; sectorId < (int)matrices.size(); sectorId++ )
+   {
+      times.push_back( std::vector<int>() );
+      for ( int g = 0; g < (int)_Generators.size(); g++ )
+      {
+         Matrix4x4 m = matrices[sectorId] * _Generators[g].matrix;
+         Perm colorPerm = _Generators[g].colorPerm * _SectorIdToColorPerm[sectorId];
+         int existing = _SectorIndex.find( m );
+         if ( existing >= 0 )
+         {
+            for ( int color = 0; color < Perm::MAX_SIZE; color++ )
+               if ( colorPerm[color] != _SectorIdToColorPerm[existing][color] )
+                  throw 777; // the same sector reached with two different color perms
+            times[sectorId].push_back( existing );
+            continue;
+         }
+         if ( (int)matrices.size() >= MAX_SECTORS )
+            throw 777;
+
+         int id = (int)matrices.size();
+         _SectorIndex.insert( m, id );
+         matrices.push_back( m );
+         _SectorIdToColorPerm.push_back( colorPerm );
+         _SectorIdToName.push_back( _SectorIdToName[sectorId] + std::to_string( g ) );
+         parent.push_back( sectorId );
+         parentGenerator.push_back( g );
+         times[sectorId].push_back( id );
+      }
+   }
+
+   int numSectors = (int)matrices.size();
+   _SectorTables.numSectors = numSectors;
+   for ( int sectorId = 0; sectorId < numSectors; sectorId++ )
+   {
+      _SectorTables.transform.push_back( RigidTransform( matrices[sectorId] ) );
+      _SectorTables.inverse.push_back( _SectorTables.transform.back().inverted() );
+      _AllSectors.push_back( SectorId( sectorId, this ) );
+   }
+
+   // a*b = a * (word of b), one generator at a time along b's parents
+   _SectorTables.mul.resize( numSectors * numSectors );
+   _SectorTables.invert.resize( numSectors );
+   for ( int a = 0; a < numSectors; a++ )
+   {
+      int32_t* row = &_SectorTables.mul[a * numSectors];
+      row[0] = a;
+      for ( int b = 1; b < numSectors; b++ )
+         row[b] = times[row[parent[b]]][parentGenerator[b]];
+      for ( int b = 0; b < numSectors; b++ )
+         if ( row[b] == 0 )
+            _SectorTables.invert[a] = b;
+   }
+
+   for ( const Perm& perm : _SectorIdToColorPerm )
+   {
+      Perm inverse = perm.inverted();
+      for ( int color = 0; color < SectorTables::COLOR_STRIDE; color++ )
+      {
+         _SectorTables.colorMap.push_back( (uint8_t) perm[color] );
+         _SectorTables.colorUnmap.push_back( (uint8_t) inverse[color] );
+      }
+   }
+}
+
+Json GraphSymmetry_Closure::toJson() const
+{
+   JsonArray generators;
+   for ( const Generator& g : _Generators )
+      generators.push_back( JsonObj { { "matrix", g.matrix.toJson() }, { "colorPerm", g.colorPerm.toJson() } } );
+   return JsonObj { { "type", "closure" }, { "generators", generators } };
+}
+
+namespace
+{
+   uint32_t zigzag( int x ) { return x >= 0 ? 2 * (uint32_t) x : 2 * (uint32_t) -(x+1) + 1; }
+   int unzigzag( uint32_t z ) { return z & 1 ? -(int)( z >> 1 ) - 1 : (int)( z >> 1 ); }
+
+   const int LATTICE_COORD_BITS = 21; // per dimension, so 3 interleaved dimensions fit in 63 bits
+}
+
+GraphSymmetry_Lattice::GraphSymmetry_Lattice( const std::vector<SymmetryGroup>& groups ) : _Groups( groups )
+{
+   std::vector<GraphSymmetry_Closure::Generator> pointGenerators;
+   for ( const SymmetryGroup& g : _Groups )
+   {
+      if ( g.isFinite() )
+      {
+         pointGenerators.push_back( { g.matrix( 1 ), g.colorPerm( 1 ) } );
+         continue;
+      }
+
+      Matrix4x4 m = g.matrix( 1 );
+      if ( _NumDimensions >= MAX_DIMENSIONS || !Matrix4x4::translation( m[3].toXYZ() ).eq( m ) )
+         throw 777; // not a translation
+
+      int dim = _NumDimensions++;
+      _Translations[dim] = m[3].toXYZ();
+      Perm perm = g.colorPerm( 1 );
+      Perm power( perm.size() );
+      do
+      {
+         _TranslationColorPowers[dim].push_back( power );
+         power = perm * power;
+      } while ( !power.isIdentity() );
+      _LoIndex[dim] = g.loIndex();
+      _HiIndex[dim] = g.hiIndex();
+      _VisibleLoIndex[dim] = g.visibleLoIndex();
+      _VisibleHiIndex[dim] = g.visibleHiIndex();
+   }
+   _PointGroup.reset( new GraphSymmetry_Closure( pointGenerators ) );
+
+   // dual basis = inverse Gram matrix * translations
+   int k = _NumDimensions;
+   double gram[MAX_DIMENSIONS][2*MAX_DIMENSIONS];
+   for ( int i = 0; i < k; i++ )
+   for ( int j = 0; j < 2*k; j++ )
+      gram[i][j] = j < k ? _Translations[i] * _Translations[j] : ( j-k == i ? 1 : 0 );
+   for ( int col = 0; col < k; col++ )
+   {
+      int pivot = col;
+      for ( int r = col+1; r < k; r++ )
+         if ( std::abs( gram[r][col] ) > std::abs( gram[pivot][col] ) )
+            pivot = r;
+      if ( std::abs( gram[pivot][col] ) < 1e-9 )
+         throw 777; // translations are linearly dependent
+      std::swap( gram[col], gram[pivot] );
+      for ( int r = 0; r < k; r++ ) if ( r != col )
+      {
+         double f = gram[r][col] / gram[col][col];
+         for ( int j = 0; j < 2*k; j++ )
+            gram[r][j] -= f * gram[col][j];
+      }
+   }
+   for ( int i = 0; i < k; i++ )
+   {
+      _DualBasis[i] = XYZ();
+      for ( int j = 0; j < k; j++ )
+         _DualBasis[i] += _Translations[j] * ( gram[i][k+j] / gram[i][i] );
+   }
+
+   // each point group element must map lattice vectors to lattice vectors
+   for ( int point = 0; point < _PointGroup->numSectors(); point++ )
+   {
+      Matrix4x4 m = _PointGroup->matrix( point );
+      std::vector<int> action( k * k );
+      for ( int j = 0; j < k; j++ )
+      {
+         const XYZ& t = _Translations[j];
+         XYZW rotated = m * XYZW( t.x, t.y, t.z, 0 );
+         int n[MAX_DIMENSIONS];
+         if ( !latticeCoords( XYZ( rotated.x, rotated.y, rotated.z ), n ) )
+            throw 777;
+         for ( int i = 0; i < k; i++ )
+            action[i*k+j] = n[i];
+      }
+      _Action.insert( _Action.end(), action.begin(), action.end() );
+   }
+
+   // only the window is listed, other sectors exist only as ids
+   Sector sector;
+   for ( int i = 0; i < k; i++ )
+      sector.n[i] = _LoIndex[i];
+   while ( true )
+   {
+      bool isVisible = true;
+      for ( int i = 0; i < k; i++ )
+         isVisible = isVisible && sector.n[i] >= _VisibleLoIndex[i] && sector.n[i] < _VisibleHiIndex[i];
+      for ( sector.point = 0; sector.point < _PointGroup->numSectors(); sector.point++ )
+      {
+         int id = sectorId( sector );
+         if ( id < 0 )
+            throw 777;
+         _AllSectors.push_back( SectorId( id, this ) );
+         if ( isVisible )
+            _AllVisibleSectors.push_back( SectorId( id, this ) );
+      }
+
+      int i = 0;
+      for ( ; i < k && ++sector.n[i] >= _HiIndex[i]; i++ )
+         sector.n[i] = _LoIndex[i];
+      if ( i == k )
+         break;
+   }
+   std::sort( _AllSectors.begin(), _AllSectors.end() );
+   std::sort( _AllVisibleSectors.begin(), _AllVisibleSectors.end() );
+}
+
+GraphSymmetry_Lattice::Sector GraphSymmetry_Lattice::sector( int sectorId ) const
+{
+   if ( !isSectorId( sectorId ) )
+      throw 777;
+
+   Sector ret;
+   int numPoints = _PointGroup->numSectors();
+   ret.point = sectorId % numPoints;
+   uint64_t packed = sectorId / numPoints;
+   uint32_t z[MAX_DIMENSIONS] = {};
+   for ( int bit = 0; packed && _NumDimensions; bit++ )
+   for ( int i = 0; i < _NumDimensions; i++, packed >>= 1 )
+      z[i] |= (uint32_t) ( packed & 1 ) << bit;
+   for ( int i = 0; i < _NumDimensions; i++ )
+      ret.n[i] = unzigzag( z[i] );
+   return ret;
+}
+
+int GraphSymmetry_Lattice::sectorId( const Sector& sector ) const
+{
+   uint64_t packed = 0;
+   for ( int i = 0; i < _NumDimensions; i++ )
+   {
+      uint32_t z = zigzag( sector.n[i] );
+      if ( z >> LATTICE_COORD_BITS )
+         return -1;
+      for ( int bit = 0; z >> bit; bit++ )
+         packed |= (uint64_t) ( ( z >> bit ) & 1 ) << ( bit * _NumDimensions + i );
+   }
+   int numPoints = _PointGroup->numSectors();
+   if ( packed > (uint64_t) ( INT_MAX - sector.point ) / numPoints )
+      return -1;
+   return (int) ( packed * numPoints ) + sector.point;
+}
+
+bool GraphSymmetry_Lattice::latticeCoords( const XYZ& v, int* n ) const
+{
+   XYZ rest = v;
+   for ( int i = 0; i < _NumDimensions; i++ )
+   {
+      n[i] = (int) std::lround( _DualBasis[i] * v );
+      rest -= _Translations[i] * n[i];
+   }
+   return rest.len2() < 1e-12;
+}
+
+XYZ GraphSymmetry_Lattice::translation( const Sector& sector ) const
+{
+   XYZ ret;
+   for ( int i = 0; i < _NumDimensions; i++ )
+      ret += _Translations[i] * sector.n[i];
+   return ret;
+}
+
+int GraphSymmetry_Lattice::sectorId( const Matrix4x4& m ) const
+{
+   for ( int point = 0; point < _PointGroup->numSectors(); point++ )
+   {
+      Matrix4x4 t = m * _PointGroup->matrix( _PointGroup->inverted( point ) );
+      if ( !Matrix4x4::translation( t[3].toXYZ() ).eq( t ) )
+         continue;
+      Sector sector;
+      sector.point = point;
+      return latticeCoords( t[3].toXYZ(), sector.n ) ? sectorId( sector ) : -1;
+   }
+   return -1;
+}
+
+Matrix4x4 GraphSymmetry_Lattice::matrix( int sectorId ) const
+{
+   Sector s = sector( sectorId );
+   return Matrix4x4::translation( translation( s ) ) * _PointGroup->matrix( s.point );
+}
+
+int GraphSymmetry_Lattice::mul( int sectorA, int sectorB ) const
+{
+   if ( sectorA < 0 || sectorB < 0 )
+      return -1;
+
+   // T(a) * P * T(b) * Q = T(a + P(b)) * P*Q
+   Sector a = sector( sectorA );
+   Sector b = sector( sectorB );
+   int k = _NumDimensions;
+   const int* action = _Action.data() + a.point * k * k;
+   Sector ret;
+   ret.point = _PointGroup->mul( a.point, b.point );
+   for ( int i = 0; i < k; i++ )
+   {
+      ret.n[i] = a.n[i];
+      for ( int j = 0; j < k; j++ )
+         ret.n[i] += action[i*k+j] * b.n[j];
+   }
+   return sectorId( ret );
+}
+
+int GraphSymmetry_Lattice::inverted( int sectorId ) const
+{
+   if ( sectorId < 0 )
+      return -1;
+
+   // (T(a) * P)^-1 = T(-P^-1(a)) * P^-1
+   Sector s = sector( sectorId );
+   int k = _NumDimensions;
+   Sector ret;
+   ret.point = _PointGroup->inverted( s.point );
+   const int* action = _Action.data() + ret.point * k * k;
+   for ( int i = 0; i < k; i++ )
+   for ( int j = 0; j < k; j++ )
+      ret.n[i] -= action[i*k+j] * s.n[j];
+   return this->sectorId( ret );
+}
+
+int GraphSymmetry_Lattice::colorOfTranslation( int dim, int n, int color ) const
+{
+   const std::vector<Perm>& powers = _TranslationColorPowers[dim];
+   return powers[mod( n, (int) powers.size() )][color];
+}
+
+int GraphSymmetry_Lattice::toSector( int sectorId, int color ) const
+{
+   Sector s = sector( sectorId );
+   color = _PointGroup->toSector( s.point, color );
+   for ( int i = _NumDimensions-1; i >= 0; i-- )
+      color = colorOfTranslation( i, s.n[i], color );
+   return color;
+}
+
+int GraphSymmetry_Lattice::fromSector( int sectorId, int color ) const
+{
+   Sector s = sector( sectorId );
+   for ( int i = 0; i < _NumDimensions; i++ )
+      color = colorOfTranslation( i, -s.n[i], color );
+   return _PointGroup->fromSector( s.point, color );
+}
+
+bool GraphSymmetry_Lattice::isSectorIdVisible( int sectorId ) const
+{
+   Sector s = sector( sectorId );
+   for ( int i = 0; i < _NumDimensions; i++ )
+      if ( s.n[i] < _VisibleLoIndex[i] || s.n[i] >= _VisibleHiIndex[i] )
+         return false;
+   return true;
+}
+
+std::string GraphSymmetry_Lattice::sectorName( int sectorId ) const
+{
+   if ( sectorId == 0 )
+      return "";
+   Sector s = sector( sectorId );
+   std::string ret = _PointGroup->sectorName( s.point ) + "(";
+   for ( int i = 0; i < _NumDimensions; i++ )
+      ret += ( i ? "," : "" ) + std::to_string( s.n[i] );
+   return ret + ")";
+}
+
+Json GraphSymmetry_Lattice::toJson() const
+{
+   JsonArray groups;
+   for ( const SymmetryGroup& g : _Groups )
+      groups.push_back( g.toJson() );
+   return JsonObj { { "type", "lattice" }, { "groups", groups } };
+}
+
 std::shared_ptr<IGraphSymmetry> IGraphSymmetry::fromJson( const Json& json )
 {
+   if ( json.type() == Json::OBJECT && json["type"] == "lattice" )
+   {
+      std::vector<SymmetryGroup> symmetryGroups;
+      for ( const Json& e : json["groups"].toArray() )
+         symmetryGroups.push_back( SymmetryGroup( e ) );
+      return std::shared_ptr<IGraphSymmetry>( new GraphSymmetry_Lattice( symmetryGroups ) );
+   }
+   if ( json.type() == Json::OBJECT && json["type"] == "closure" )
+      return std::shared_ptr<IGraphSymmetry>( new GraphSymmetry_Closure( json ) );
+
    std::vector<SymmetryGroup> symmetryGroups;
    for ( const Json& e : json.toArray() )
       symmetryGroups.push_back( SymmetryGroup( e ) );
@@ -161,30 +724,57 @@ std::shared_ptr<IGraphSymmetry> IGraphSymmetry::fromJson( const Json& json )
 
 
 
-SectorSymmetryForVertex::SectorSymmetryForVertex( const IGraphSymmetry* graphSymmetry, const XYZ& pos ) : _GraphSymmetry( graphSymmetry )
-{   
-   std::vector<SectorId> allSectors = _GraphSymmetry->allSectors();
-
-   _EquivalentSectorIds.resize( allSectors.size() );
-   //_EquivalentSectors.resize( allSectors.size() );
+std::shared_ptr<SectorSymmetryForVertex> IGraphSymmetry::calcSectorSymmetry( const XYZ& pos ) const
+{
+   // one pass over the orbit of `pos`
+   std::vector<SectorId> stabilizer;
+   std::vector<int> key;
+   for ( const SectorId& sector : allSectors() )
+      if ( ( sector.matrix() * pos ).dist2( pos ) < 1e-12 )
+         stabilizer.push_back( sector );
+   std::sort( stabilizer.begin(), stabilizer.end() );
+   for ( const SectorId& sector : stabilizer )
+      key.push_back( sector.id() );
+
+   std::lock_guard<std::mutex> lock( _SectorSymmetriesMutex );
+   std::shared_ptr<SectorSymmetryForVertex>& ret = _SectorSymmetries[key];
+   if ( !ret )
+      ret.reset( new SectorSymmetryForVertex( this, stabilizer ) );
+   return ret;
+}
 
-   for ( int a = 0; a < (int)allSectors.size(); a++ )
-   for ( int b = 0; b < (int)allSectors.size(); b++ )
+SectorSymmetryForVertex::SectorSymmetryForVertex( const IGraphSymmetry* graphSymmetry, const std::vector<SectorId>& stabilizer ) : _GraphSymmetry( graphSymmetry ), _Stabilizer( stabilizer )
+{   
+   // sectors a and b are equivalent iff a^-1*b is in the stabilizer
+   if ( hasSymmetry() && _GraphSymmetry->_Tables ) // dense ids, so tabulate
    {
-      XYZ posA = allSectors[a].matrix() * pos;
-      XYZ posB = allSectors[b].matrix() * pos;
-      if ( posA.dist2( posB ) < 1e-12 )
+      int numSectors = _GraphSymmetry->numSectors();
+      _CanonicalSectorIds.resize( numSectors );
+      for ( int a = 0; a < numSectors; a++ )
       {
-         _EquivalentSectorIds[a].push_back( SectorId( b, graphSymmetry ) );
-         //_EquivalentSectors[a].push_back( allSectors[b] );
+         std::vector<SectorId> equivalents = sectorEquivalents( SectorId( a, graphSymmetry ) );
+         _CanonicalSectorIds[a] = equivalents[0].id();
       }
    }
 
-   for ( int a = 0; a < (int)allSectors.size(); a++ ) if ( _GraphSymmetry->isSectorIdVisible( a ) )
-      if ( _EquivalentSectorIds[a][0].id() == a )
-         _UniqueSectors.push_back( allSectors[a] );
+   _EquivalentsToIdentity = sectorEquivalents( SectorId( _GraphSymmetry->sectorId( Matrix4x4() ), graphSymmetry ) );
 
-   _IdentitySectorId = graphSymmetry->sectorId( Matrix4x4() );
+   for ( const SectorId& sector : _GraphSymmetry->allVisibleSectors() )
+      if ( canonicalizedSectorId( sector ) == sector )
+         _UniqueSectors.push_back( sector );
+}
+
+std::vector<SectorId> SectorSymmetryForVertex::sectorEquivalents( const SectorId& sectorId ) const
+{
+   std::vector<SectorId> ret;
+   for ( const SectorId& s : _Stabilizer )
+   {
+      SectorId equivalent = sectorId * s;
+      if ( equivalent.isValid() )
+         ret.push_back( equivalent );
+   }
+   std::sort( ret.begin(), ret.end() );
+   return ret;
 }
 
 //Matrix4x4 SectorSymmetryForVertex::canonicalizedSector( const Matrix4x4& sector ) const
@@ -200,7 +790,9 @@ SectorId SectorSymmetryForVertex::canonicalizedSectorId( const SectorId& sectorI
    if ( !hasSymmetry() )
       return sectorId;
 
-   return _EquivalentSectorIds[sectorId.id()][0];
+   if ( sectorId.id() < (int)_CanonicalSectorIds.size() )
+      return SectorId( _CanonicalSectorIds[sectorId.id()], _GraphSymmetry );
+   return sectorEquivalents( sectorId )[0];
 }
 
 std::shared_ptr<IGraphShape> IGraphShape::fromJson( const Json& json )
@@ -212,12 +804,3 @@ std::shared_ptr<IGraphShape> IGraphShape::fromJson( const Json& json )
    throw 777;
    return nullptr;
 }
-
-
-
-SectorId SectorId::operator*( const SectorId& rhs ) const { return SectorId( _GraphSymmetry->mul( _Id, rhs._Id ), _GraphSymmetry ); }
-SectorId SectorId::inverted() const { return SectorId( _GraphSymmetry->inverted( _Id ), _GraphSymmetry ); }
-Matrix4x4 SectorId::matrix() const { return _GraphSymmetry->matrix( _Id ); }
-
-int SectorId::mapColor( int color ) const { return _GraphSymmetry->toSector( _Id, color ); }
-int SectorId::unmapColor( int color ) const { return _GraphSymmetry->fromSector( _Id, color ); }
\ No newline at end of file
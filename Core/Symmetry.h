@@ -4,11 +4,15 @@
 #include "DataTypes.h"
 #include "Util.h"
 #include "Json.h"
+#include "MatrixIndex.h"
 
 #include <vector>
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <map>
+#include <mutex>
+#include <climits>
 
 class IGraphSymmetry;
 
@@ -28,6 +32,22 @@ class IGraphSymmetry;
 
 
 class IGraphSymmetry;
+
+// dense tables over sector ids, which `SectorId` indexes directly (no virtual call, no allocation)
+struct SectorTables
+{
+   static const int COLOR_STRIDE = 16; // colors [0,COLOR_STRIDE) are tabulated, others map to themselves
+
+   int numSectors = 0;
+   std::vector<int32_t> mul;        // mul[a*numSectors+b] = a*b
+   std::vector<int32_t> invert;
+   std::vector<uint8_t> colorMap;   // colorMap[sectorId*COLOR_STRIDE+color]
+   std::vector<uint8_t> colorUnmap; // inverse of colorMap
+   std::vector<Matrix4x4> matrix;
+   std::vector<RigidTransform> transform;
+   std::vector<RigidTransform> inverse;  // inverse[s] = transform[s].inverted()
+};
+
 class CORE_API SectorId
 {
 public:
@@ -47,6 +67,8 @@ public:
    SectorId operator*( const SectorId& rhs ) const;
    SectorId inverted() const;
    Matrix4x4 matrix() const;
+   RigidTransform transform() const;
+   RigidTransform inverseTransform() const;
 
    int mapColor( int color ) const;
    int unmapColor( int color ) const;
@@ -58,30 +80,34 @@ private:
 };
 
 
+// the stabilizer of a vertex position, and what follows from it.  Interned by `IGraphSymmetry::calcSectorSymmetry`,
+// so all vertices with the same stabilizer share one (most share the trivial one)
 class SectorSymmetryForVertex
 {
 public:
-   SectorSymmetryForVertex( const IGraphSymmetry* _GraphSymmetry, const XYZ& pos );
+   SectorSymmetryForVertex( const IGraphSymmetry* graphSymmetry, const std::vector<SectorId>& stabilizer );
 
-   std::vector<SectorId> uniqueSectors() const { return _UniqueSectors; }
-   std::vector<SectorId> sectorEquivalents( const SectorId& sectorId ) const { return _EquivalentSectorIds[sectorId.id()]; }
-   std::vector<SectorId> sectorEquivalentsToIdentity() const { return _EquivalentSectorIds[_IdentitySectorId]; }
+   const std::vector<SectorId>& uniqueSectors() const { return _UniqueSectors; }
+   std::vector<SectorId> sectorEquivalents( const SectorId& sectorId ) const;
+   const std::vector<SectorId>& sectorEquivalentsToIdentity() const { return _EquivalentsToIdentity; }
    SectorId canonicalizedSectorId( const SectorId& sectorId ) const;
    //int canonicalizedSectorId( int sectorId ) const;
-   bool hasSymmetry() const { return _EquivalentSectorIds[0].size() > 1; }
+   bool hasSymmetry() const { return _Stabilizer.size() > 1; }
+   const std::vector<SectorId>& stabilizer() const { return _Stabilizer; }
 
 private:
    const IGraphSymmetry* _GraphSymmetry = nullptr;
-   std::vector<std::vector<SectorId>> _EquivalentSectorIds;
-   //std::vector<std::vector<Matrix4x4>> _EquivalentSectors;
+   std::vector<SectorId> _Stabilizer; // sectors fixing the vertex, sorted
+   std::vector<int32_t> _CanonicalSectorIds; // only when the sector ids are dense and there is symmetry
+   std::vector<SectorId> _EquivalentsToIdentity;
    std::vector<SectorId> _UniqueSectors;
-   int _IdentitySectorId = -1;
 };
 
 class IGraphSymmetry
 {
 public:
-   virtual int numSectors() const = 0;
+   virtual int numSectors() const = 0; // size of `allSectors()`, which bounds the ids only if they are dense
+   virtual int maxSectorId() const { return numSectors() - 1; } // INT_MAX if the ids are unbounded
    virtual int toSector( int sectorId, int color ) const = 0;
    virtual int fromSector( int sectorId, int color ) const = 0;
    virtual int sectorId( const Matrix4x4& sector ) const = 0;
@@ -90,15 +116,63 @@ public:
    virtual std::vector<SectorId> allSectors() const = 0;
    virtual Matrix4x4 matrix( int sectorId ) const = 0;
    virtual bool isSectorIdVisible( int sectorId ) const = 0;
+   virtual bool isSectorId( int sectorId ) const { return sectorId >= 0 && sectorId < numSectors(); } // any int an id could decode to
    virtual int mul( int sectorA, int sectorB ) const = 0;
    virtual int inverted( int sectorId ) const = 0;
 
    virtual Json toJson() const = 0;
    static std::shared_ptr<IGraphSymmetry> fromJson( const Json& json );
 
-   std::shared_ptr<SectorSymmetryForVertex> calcSectorSymmetry( const XYZ& pos ) const { return std::shared_ptr<SectorSymmetryForVertex>( new SectorSymmetryForVertex( this, pos ) ); }
+   std::shared_ptr<SectorSymmetryForVertex> calcSectorSymmetry( const XYZ& pos ) const;
+
+public:
+   const SectorTables* _Tables = nullptr; // set by implementations that have dense tables, otherwise `SectorId` uses the virtual functions
+
+private:
+   mutable std::mutex _SectorSymmetriesMutex;
+   mutable std::map<std::vector<int>, std::shared_ptr<SectorSymmetryForVertex>> _SectorSymmetries; // by stabilizer ids
 };
 
+inline SectorId SectorId::operator*( const SectorId& rhs ) const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   return SectorId( t ? t->mul[_Id * t->numSectors + rhs._Id] : _GraphSymmetry->mul( _Id, rhs._Id ), _GraphSymmetry );
+}
+inline SectorId SectorId::inverted() const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   return SectorId( t ? t->invert[_Id] : _GraphSymmetry->inverted( _Id ), _GraphSymmetry );
+}
+inline Matrix4x4 SectorId::matrix() const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   return t ? t->matrix[_Id] : _GraphSymmetry->matrix( _Id );
+}
+inline RigidTransform SectorId::transform() const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   return t ? t->transform[_Id] : RigidTransform( _GraphSymmetry->matrix( _Id ) );
+}
+inline RigidTransform SectorId::inverseTransform() const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   return t ? t->inverse[_Id] : RigidTransform( _GraphSymmetry->matrix( _Id ) ).inverted();
+}
+inline int SectorId::mapColor( int color ) const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   if ( t && color >= 0 && color < SectorTables::COLOR_STRIDE )
+      return t->colorMap[_Id * SectorTables::COLOR_STRIDE + color];
+   return _GraphSymmetry->toSector( _Id, color );
+}
+inline int SectorId::unmapColor( int color ) const
+{
+   const SectorTables* t = _GraphSymmetry->_Tables;
+   if ( t && color >= 0 && color < SectorTables::COLOR_STRIDE )
+      return t->colorUnmap[_Id * SectorTables::COLOR_STRIDE + color];
+   return _GraphSymmetry->fromSector( _Id, color );
+}
+
 
 class SymmetryGroup
 {
@@ -110,12 +184,13 @@ public:
    CORE_API int visibleHiIndex() const { return _VisibleHiIndex; }
    CORE_API int loIndex() const { return _LoIndex; }
    CORE_API int hiIndex() const { return _HiIndex; }
+   CORE_API bool isFinite() const { return _IsFinite; }
    
    CORE_API int canonicalizedIndex( int index ) const { return _IsFinite ? mod( index - _LoIndex, size() ) + _LoIndex : index; }
    //CORE_API int visibleSize() const { return _VisibleHiIndex - _VisibleLoIndex; }
    CORE_API int size() const { return _HiIndex - _LoIndex; }
-   CORE_API Matrix4x4 matrix( int index ) const { return _Matrix.pow( canonicalizedIndex( index ) ); }
-   CORE_API Perm colorPerm( int index ) const { return _ColorPerm.pow( canonicalizedIndex( index ) ); }
+   CORE_API Matrix4x4 matrix( int index ) const { int i = canonicalizedIndex( index ); return i >= _LoIndex && i < _HiIndex ? _MatrixPowers[i-_LoIndex] : _Matrix.pow( i ); }
+   CORE_API Perm colorPerm( int index ) const { int i = canonicalizedIndex( index ); return i >= _LoIndex && i < _HiIndex ? _ColorPermPowers[i-_LoIndex] : _ColorPerm.pow( i ); }
    //CORE_API int combine( int indexA, int indexB ) const { return indexOf( matrix( indexA ) * matrix( indexB ) ); }
    CORE_API int combine( int indexA, int indexB ) const { return canonicalizedIndex( indexA + indexB ); }
    CORE_API int invert( int index ) const { return canonicalizedIndex( -index ); }
@@ -132,6 +207,7 @@ public:
 
 private:
    void init( int visibleLoIndex, int visibleHiIndex );
+   void initPowers();
 
 private:
    Matrix4x4 _Matrix;
@@ -141,6 +217,8 @@ private:
    int       _VisibleLoIndex = 0; // inclusive
    int       _VisibleHiIndex = 0; // exclusive
    bool      _IsFinite;
+   std::vector<Matrix4x4> _MatrixPowers; // for indexes [_LoIndex,_HiIndex)
+   std::vector<Perm>      _ColorPermPowers;
 };
 
 class GraphSymmetry_Groups : public IGraphSymmetry
@@ -148,37 +226,134 @@ class GraphSymmetry_Groups : public IGraphSymmetry
 public:
    CORE_API GraphSymmetry_Groups( const std::vector<SymmetryGroup>& groups );
    CORE_API int numSectors() const override { int ret = 1; for ( const SymmetryGroup& g : _Groups ) ret *= g.size(); return ret; }
-   CORE_API int sectorId( const Matrix4x4& sector ) const override { return  _SectorHashToId.count( matrixHash( sector ) ) ? _SectorHashToId.at( matrixHash( sector ) ) : -1; }
-   CORE_API int toSector( int sectorId, int color ) const override { return _SectorIdToColorPerm[sectorId][color]; }
-   CORE_API int fromSector( int sectorId, int color ) const override { return _SectorIdToColorPerm[sectorId].inverted()[color]; }
+   CORE_API int sectorId( const Matrix4x4& sector ) const override { return _SectorIndex.find( sector ); }
+   CORE_API int toSector( int sectorId, int color ) const override { return color >= 0 && color < SectorTables::COLOR_STRIDE ? _SectorTables.colorMap[sectorId * SectorTables::COLOR_STRIDE + color] : _SectorIdToColorPerm[sectorId][color]; }
+   CORE_API int fromSector( int sectorId, int color ) const override { return color >= 0 && color < SectorTables::COLOR_STRIDE ? _SectorTables.colorUnmap[sectorId * SectorTables::COLOR_STRIDE + color] : _SectorIdToColorPerm[sectorId].inverted()[color]; }
    CORE_API std::string sectorName( int sectorId ) const { return _SectorIdToName[sectorId]; }
    CORE_API std::vector<SectorId> allVisibleSectors() const override { return _AllVisibleSectors; }
    CORE_API std::vector<SectorId> allSectors() const override { return _AllSectors; }
    CORE_API bool isSectorIdVisible( int sectorId ) const override { return _SectorIdIsVisible[sectorId]; }
-   CORE_API Matrix4x4 matrix( int sectorId ) const override { return _SectorIdToMatrix[sectorId]; }
-   CORE_API int mul( int sectorA, int sectorB ) const { return _Mul[sectorA][sectorB]; }
-   CORE_API int inverted( int sectorId ) const { return _Invert[sectorId]; }
+   CORE_API Matrix4x4 matrix( int sectorId ) const override { return _SectorTables.matrix[sectorId]; }
+   CORE_API int mul( int sectorA, int sectorB ) const { return _SectorTables.mul[sectorA * _SectorTables.numSectors + sectorB]; }
+   CORE_API int inverted( int sectorId ) const { return _SectorTables.invert[sectorId]; }
 
    CORE_API Json toJson() const override;
 
+   // where the sector tables are cached between runs, keyed by the groups (empty = no caching, the default).  The directory must exist
+   CORE_API static void setCacheDirectory( const std::string& dir );
+
 private:
    void initAllSectorGroupIndexes( int i, std::vector<int>& groupIndexes );
+   std::string tablesKey() const;
+   std::string tablesPath( const std::string& key ) const;
+   bool loadTables( const std::string& key );
+   void saveTables( const std::string& key ) const;
 
 public:
    std::vector<SymmetryGroup> _Groups;
-   std::unordered_map<uint64_t, int> _SectorHashToId;
+   MatrixIndex _SectorIndex;
    std::vector<std::vector<int>> _AllSectorGroupIndexes;
-   std::vector<Matrix4x4> _SectorIdToMatrix;
    std::vector<bool> _SectorIdIsVisible;
    std::vector<SectorId> _AllSectors;
    std::vector<SectorId> _AllVisibleSectors;
    std::vector<Perm> _SectorIdToColorPerm;
    std::vector<std::string> _SectorIdToName;
-   std::vector<std::vector<int>> _Mul;
-   std::vector<int> _Invert;
+   SectorTables _SectorTables;
 };
 
 
+// finite group generated by arbitrary (matrix, color perm) pairs, built by closure:  every group element is exactly one sector,
+// whatever the generators (GraphSymmetry_Groups takes the product of cyclic groups, which double counts unless they are independent)
+class GraphSymmetry_Closure : public IGraphSymmetry
+{
+public:
+   struct Generator
+   {
+      Matrix4x4 matrix;
+      Perm colorPerm;
+   };
+
+   CORE_API GraphSymmetry_Closure( const std::vector<Generator>& generators );
+   CORE_API GraphSymmetry_Closure( const Json& json );
+   CORE_API int numSectors() const override { return _SectorTables.numSectors; }
+   CORE_API int sectorId( const Matrix4x4& sector ) const override { return _SectorIndex.find( sector ); }
+   CORE_API int toSector( int sectorId, int color ) const override { return color >= 0 && color < SectorTables::COLOR_STRIDE ? _SectorTables.colorMap[sectorId * SectorTables::COLOR_STRIDE + color] : _SectorIdToColorPerm[sectorId][color]; }
+   CORE_API int fromSector( int sectorId, int color ) const override { return color >= 0 && color < SectorTables::COLOR_STRIDE ? _SectorTables.colorUnmap[sectorId * SectorTables::COLOR_STRIDE + color] : _SectorIdToColorPerm[sectorId].inverted()[color]; }
+   CORE_API std::string sectorName( int sectorId ) const { return _SectorIdToName[sectorId]; }
+   CORE_API std::vector<SectorId> allVisibleSectors() const override { return _AllSectors; }
+   CORE_API std::vector<SectorId> allSectors() const override { return _AllSectors; }
+   CORE_API bool isSectorIdVisible( int ) const override { return true; }
+   CORE_API Matrix4x4 matrix( int sectorId ) const override { return _SectorTables.matrix[sectorId]; }
+   CORE_API int mul( int sectorA, int sectorB ) const { return _SectorTables.mul[sectorA * _SectorTables.numSectors + sectorB]; }
+   CORE_API int inverted( int sectorId ) const { return _SectorTables.invert[sectorId]; }
+
+   CORE_API Json toJson() const override;
+
+private:
+   void init();
+
+public:
+   std::vector<Generator> _Generators;
+   MatrixIndex _SectorIndex;
+   std::vector<SectorId> _AllSectors;
+   std::vector<Perm> _SectorIdToColorPerm;
+   std::vector<std::string> _SectorIdToName; // generator indexes of a shortest word for the sector
+   SectorTables _SectorTables;
+};
+
+// periodic symmetry:  the infinite `SymmetryGroup`s must be translations, the finite ones generate a point group that maps the
+// translation lattice to itself.  A sector is (lattice coordinates, point group element), composed in closed form, and its id packs
+// the coordinates (zigzag, bit-interleaved), so there is no limit on the sectors referenced and nothing is stored per sector.
+// The lo/hi (visibleLo/visibleHi) indexes of the translation groups only bound `allSectors` (`allVisibleSectors`)
+class GraphSymmetry_Lattice : public IGraphSymmetry
+{
+public:
+   static const int MAX_DIMENSIONS = 3;
+
+   struct Sector
+   {
+      int point = 0; // sector id within `_PointGroup`
+      int n[MAX_DIMENSIONS] = {};
+   };
+
+   CORE_API GraphSymmetry_Lattice( const std::vector<SymmetryGroup>& groups );
+   CORE_API int numSectors() const override { return (int) _AllSectors.size(); }
+   CORE_API int maxSectorId() const override { return _NumDimensions > 0 ? INT_MAX : _PointGroup->numSectors() - 1; }
+   CORE_API int sectorId( const Matrix4x4& sector ) const override;
+   CORE_API int toSector( int sectorId, int color ) const override;
+   CORE_API int fromSector( int sectorId, int color ) const override;
+   CORE_API std::string sectorName( int sectorId ) const;
+   CORE_API std::vector<SectorId> allVisibleSectors() const override { return _AllVisibleSectors; }
+   CORE_API std::vector<SectorId> allSectors() const override { return _AllSectors; }
+   CORE_API bool isSectorIdVisible( int sectorId ) const override;
+   CORE_API bool isSectorId( int sectorId ) const override { return sectorId >= 0 && ( _NumDimensions > 0 || sectorId < _PointGroup->numSectors() ); }
+   CORE_API Matrix4x4 matrix( int sectorId ) const override;
+   CORE_API int mul( int sectorA, int sectorB ) const;
+   CORE_API int inverted( int sectorId ) const;
+
+   CORE_API Json toJson() const override;
+
+   CORE_API Sector sector( int sectorId ) const; // throws if not `isSectorId`
+   CORE_API int sectorId( const Sector& sector ) const; // -1 if the id doesn't fit in an int
+
+private:
+   int colorOfTranslation( int dim, int n, int color ) const;
+   XYZ translation( const Sector& sector ) const;
+   bool latticeCoords( const XYZ& v, int* n ) const;
+
+public:
+   std::vector<SymmetryGroup> _Groups;
+   std::shared_ptr<GraphSymmetry_Closure> _PointGroup;
+   int _NumDimensions = 0;
+   XYZ _Translations[MAX_DIMENSIONS];
+   XYZ _DualBasis[MAX_DIMENSIONS];                // _DualBasis[i] * _Translations[j] = (i==j)
+   std::vector<Perm> _TranslationColorPowers[MAX_DIMENSIONS]; // color perm of translation i, to the power 0..order-1
+   int _LoIndex[MAX_DIMENSIONS], _HiIndex[MAX_DIMENSIONS], _VisibleLoIndex[MAX_DIMENSIONS], _VisibleHiIndex[MAX_DIMENSIONS];
+   std::vector<int> _Action; // integer matrix of each point group element acting on lattice coordinates, _NumDimensions^2 per element
+   std::vector<SectorId> _AllSectors;
+   std::vector<SectorId> _AllVisibleSectors;
+};
+
 
 class IGraphShape
 {
@@ -196,7 +371,7 @@ public:
    static std::shared_ptr<IGraphShape> fromJson( const Json& json );
 };
 
-class GraphShapeSphere : public IGraphShape
+class GraphShapeSphere final : public IGraphShape
 {
 public:
    GraphShapeSphere( double radius ) : _Radius( radius ) {}
@@ -222,7 +397,7 @@ private:
 };
 
 
-class GraphShapePlane : public IGraphShape
+class GraphShapePlane final : public IGraphShape
 {
 public:
    GraphShapePlane() {}
@@ -238,4 +413,16 @@ public:
    bool isValidWinding( const std::vector<XYZ>& v ) const override { return signedArea( v ) >= 0; }
    bool isCurved() const override { return false; }
    virtual Json toJson() const override { return JsonObj { { "type", "plane" } }; }
-};
\ No newline at end of file
+};
+
+// calls `func( shape )` with `shape` as its concrete type, so per-vertex shape calls inside `func` are inlined instead of virtual
+// (dispatch once per loop, not once per vertex)
+template<class Func> void visitShape( const IGraphShape& shape, Func&& func )
+{
+   if ( const GraphShapeSphere* sphere = dynamic_cast<const GraphShapeSphere*>( &shape ) )
+      func( *sphere );
+   else if ( const GraphShapePlane* plane = dynamic_cast<const GraphShapePlane*>( &shape ) )
+      func( *plane );
+   else
+      func( shape );
+}
\ No newline at end of file
@@ -0,0 +1,271 @@
+#include "SymmetryDiscovery.h"
+#include "SpatialHash.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+   const double POS_TOLERANCE = 1e-6;
+
+   // the visible part of the graph, as plain arrays
+   struct FlatGraph
+   {
+      std::vector<DualGraph::VertexPtr> vertices;
+      std::vector<XYZ> pos;
+      std::vector<int> color;
+      std::vector<std::vector<int>> neighbors; // sorted
+   };
+
+   FlatGraph flatten( const DualGraph& dual )
+   {
+      FlatGraph ret;
+      ret.vertices = dual.allVisibleVertices();
+      std::unordered_map<int64_t, int> indexOfId;
+      for ( int i = 0; i < (int)ret.vertices.size(); i++ )
+      {
+         indexOfId[ret.vertices[i].id()] = i;
+         ret.pos.push_back( ret.vertices[i].pos() );
+         ret.color.push_back( ret.vertices[i].color() );
+      }
+      for ( const DualGraph::VertexPtr& a : ret.vertices )
+      {
+         ret.neighbors.push_back( {} );
+         for ( const DualGraph::VertexPtr& b : a.neighborRange() )
+            if ( indexOfId.count( b.id() ) )
+               ret.neighbors.back().push_back( indexOfId.at( b.id() ) );
+         std::sort( ret.neighbors.back().begin(), ret.neighbors.back().end() );
+      }
+      return ret;
+   }
+
+   // orthonormal frame (origin, axes) of the edge a-b:  on the sphere it's centered at the origin, in the plane at `a`
+   void frameOf( bool isSphere, const XYZ& a, const XYZ& b, XYZ& origin, XYZ* axes )
+   {
+      if ( isSphere )
+      {
+         origin = XYZ();
+         axes[0] = a.normalized();
+         axes[1] = ( b - axes[0] * ( b * axes[0] ) ).normalized();
+      }
+      else
+      {
+         origin = a;
+         axes[0] = ( b - a ).normalized();
+         axes[1] = XYZ( 0, 0, 1 ) ^ axes[0];
+      }
+      axes[2] = axes[0] ^ axes[1];
+   }
+
+   // the rotation taking edge a-b to edge a2-b2, or the reflection if `isReflection`
+   RigidTransform edgeToEdge( bool isSphere, const XYZ& a, const XYZ& b, const XYZ& a2, const XYZ& b2, bool isReflection )
+   {
+      XYZ origin, origin2, axes[3], axes2[3];
+      frameOf( isSphere, a, b, origin, axes );
+      frameOf( isSphere, a2, b2, origin2, axes2 );
+      if ( isReflection )
+      {
+         if ( isSphere )
+            axes2[2] = -axes2[2];
+         else
+            axes2[1] = -axes2[1]; // the plane's normal stays put
+      }
+
+      RigidTransform ret;
+      for ( int r = 0; r < 3; r++ )
+      for ( int c = 0; c < 3; c++ )
+      {
+         double x = 0;
+         for ( int k = 0; k < 3; k++ )
+         {
+            const double ar = r == 0 ? axes2[k].x : r == 1 ? axes2[k].y : axes2[k].z;
+            const double ac = c == 0 ? axes[k].x : c == 1 ? axes[k].y : axes[k].z;
+            x += ar * ac;
+         }
+         ret.rot[r*3+c] = x;
+      }
+      ret.trans = origin2 - ret.rotate( origin );
+      return ret;
+   }
+
+   // image of every vertex under `t`, and the color permutation, or false if `t` isn't a symmetry of the graph.
+   // blank vertices must go to blank ones, and the permutation keeps `BLANK_COLOR` fixed
+   bool checkSymmetry( const FlatGraph& g, const SpatialHash& hash, const RigidTransform& t, std::vector<int>& image, Perm& colorPerm )
+   {
+      int n = (int)g.pos.size();
+      image.assign( n, -1 );
+      for ( int i = 0; i < n; i++ )
+      {
+         XYZ p = t * g.pos[i];
+         hash.forEachNear( p, [&]( int j ) {
+            if ( g.pos[j].dist2( p ) < POS_TOLERANCE * POS_TOLERANCE )
+               image[i] = j;
+         } );
+         if ( image[i] < 0 )
+            return false;
+      }
+
+      int colorMap[Perm::MAX_SIZE];
+      bool isUsed[Perm::MAX_SIZE] = {};
+      std::fill( colorMap, colorMap + Perm::MAX_SIZE, -1 );
+      colorMap[BLANK_COLOR] = BLANK_COLOR;
+      isUsed[BLANK_COLOR] = true;
+      for ( int i = 0; i < n; i++ )
+      {
+         int c = g.color[i];
+         int c2 = g.color[image[i]];
+         if ( c < 0 || c >= Perm::MAX_SIZE || c2 < 0 || c2 >= Perm::MAX_SIZE || ( c == BLANK_COLOR ) != ( c2 == BLANK_COLOR ) )
+            return false;
+         if ( c == BLANK_COLOR )
+            continue;
+         if ( colorMap[c] < 0 && !isUsed[c2] )
+         {
+            colorMap[c] = c2;
+            isUsed[c2] = true;
+         }
+         if ( colorMap[c] != c2 )
+            return false;
+      }
+
+      for ( int i = 0; i < n; i++ )
+      {
+         const std::vector<int>& neighbors2 = g.neighbors[image[i]];
+         if ( neighbors2.size() != g.neighbors[i].size() )
+            return false;
+         for ( int j : g.neighbors[i] )
+            if ( !std::binary_search( neighbors2.begin(), neighbors2.end(), image[j] ) )
+               return false;
+      }
+
+      // colors that don't occur go to the targets that are left, in order
+      colorPerm = Perm( MAX_COLORS+1 );
+      for ( int c = 0, free = 0; c <= MAX_COLORS; c++ )
+      {
+         if ( colorMap[c] < 0 )
+         {
+            while ( isUsed[free] )
+               free++;
+            colorMap[c] = free;
+            isUsed[free] = true;
+         }
+         colorPerm.v[c] = (uint8_t) colorMap[c];
+      }
+      return true;
+   }
+
+   struct Symmetry
+   {
+      GraphSymmetry_Closure::Generator generator;
+      std::vector<int> image;
+   };
+
+   std::vector<Symmetry> findSymmetries( const DualGraph& dual, const FlatGraph& g )
+   {
+      std::vector<Symmetry> ret;
+      int n = (int)g.pos.size();
+      Symmetry identity;
+      identity.generator = { Matrix4x4(), Perm( MAX_COLORS+1 ) };
+      for ( int i = 0; i < n; i++ )
+         identity.image.push_back( i );
+      ret.push_back( identity );
+
+      // an infinite group can't be recognized from its visible part
+      if ( dual._GraphSymmetry->allVisibleSectors().size() != dual._GraphSymmetry->allSectors().size() )
+         return ret;
+
+      // the anchor edge:  from a vertex of the rarest degree
+      int a = -1;
+      int bestCount = n + 1;
+      for ( int i = 0; i < n; i++ ) if ( !g.neighbors[i].empty() )
+      {
+         int count = 0;
+         for ( int j = 0; j < n; j++ )
+            count += g.neighbors[j].size() == g.neighbors[i].size();
+         if ( count < bestCount )
+         {
+            bestCount = count;
+            a = i;
+         }
+      }
+      if ( a < 0 )
+         return ret;
+      int b = g.neighbors[a][0];
+
+      double edgeLen = g.pos[a].dist( g.pos[b] );
+      bool isSphere = dynamic_cast<const GraphShapeSphere*>( dual._GraphShape.get() ) != nullptr;
+      SpatialHash hash( edgeLen / 2 );
+      for ( int i = 0; i < n; i++ )
+         hash.insert( g.pos[i], i );
+
+      // a rotation or reflection is determined by where it takes the anchor edge
+      for ( int a2 = 0; a2 < n; a2++ ) if ( g.neighbors[a2].size() == g.neighbors[a].size() )
+      for ( int b2 : g.neighbors[a2] )
+      {
+         if ( std::abs( g.pos[a2].dist( g.pos[b2] ) - edgeLen ) > POS_TOLERANCE )
+            continue;
+         if ( isSphere && std::abs( g.pos[a2].len() - g.pos[a].len() ) > POS_TOLERANCE )
+            continue;
+
+         for ( bool isReflection : { false, true } )
+         {
+            if ( a2 == a && b2 == b && !isReflection )
+               continue; // identity
+            Symmetry s;
+            RigidTransform t = edgeToEdge( isSphere, g.pos[a], g.pos[b], g.pos[a2], g.pos[b2], isReflection );
+            if ( !checkSymmetry( g, hash, t, s.image, s.generator.colorPerm ) )
+               continue;
+            s.generator.matrix = t.toMatrix();
+            ret.push_back( s );
+         }
+      }
+      return ret;
+   }
+}
+
+std::vector<GraphSymmetry_Closure::Generator> findGraphSymmetries( const DualGraph& dual )
+{
+   std::vector<GraphSymmetry_Closure::Generator> ret;
+   for ( const Symmetry& s : findSymmetries( dual, flatten( dual ) ) )
+      ret.push_back( s.generator );
+   return ret;
+}
+
+std::shared_ptr<DualGraph> quotientBySymmetries( const DualGraph& dual )
+{
+   FlatGraph g = flatten( dual );
+   std::vector<Symmetry> symmetries = findSymmetries( dual, g );
+   if ( (int)symmetries.size() <= dual._GraphSymmetry->numSectors() )
+      return nullptr;
+
+   std::vector<GraphSymmetry_Closure::Generator> generators;
+   for ( const Symmetry& s : symmetries )
+      generators.push_back( s.generator );
+   std::shared_ptr<GraphSymmetry_Closure> symmetry( new GraphSymmetry_Closure( generators ) );
+   if ( symmetry->numSectors() != (int)symmetries.size() )
+      return nullptr; // not closed, so some rotation was missed
+   std::shared_ptr<DualGraph> ret( new DualGraph( symmetry, dual._GraphShape ) );
+
+   // one vertex per orbit;  vertex i = sector orbitSector[i] applied to vertex orbitVertex[i]
+   int n = (int)g.pos.size();
+   std::vector<int> orbitVertex( n, -1 );
+   std::vector<int> orbitSector( n, -1 );
+   std::vector<int> representatives;
+   for ( int i = 0; i < n; i++ ) if ( orbitVertex[i] < 0 )
+   {
+      int index = (int)representatives.size();
+      representatives.push_back( i );
+      ret->addVertex( g.color[i], g.pos[i] );
+      for ( const Symmetry& s : symmetries )
+         if ( orbitVertex[s.image[i]] < 0 )
+         {
+            orbitVertex[s.image[i]] = index;
+            orbitSector[s.image[i]] = symmetry->sectorId( s.generator.matrix );
+         }
+   }
+
+   for ( int index = 0; index < (int)representatives.size(); index++ )
+      for ( int j : g.neighbors[representatives[index]] )
+         ret->_Vertices[index].neighbors.push_back( DualGraph::VertexPtr( ret.get(), orbitVertex[j], SectorId( orbitSector[j], symmetry.get() ) ).handle() );
+   ret->sortNeighbors();
+   return ret;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "CoreMacros.h"
+#include "DualGraph.h"
+#include "Symmetry.h"
+
+#include <memory>
+#include <vector>
+
+// every rotation and reflection (about the sphere center, or in the plane) that maps the visible vertices of `dual` onto themselves,
+// respecting edges and permuting colors consistently, blank vertices staying blank.  Only for graphs with finite symmetry, otherwise returns just the identity
+CORE_API std::vector<GraphSymmetry_Closure::Generator> findGraphSymmetries( const DualGraph& dual );
+
+// `dual` rebuilt over the fundamental domain of `findGraphSymmetries`, with that group as its symmetry.
+// nullptr if there is no more symmetry than `dual` already has
+CORE_API std::shared_ptr<DualGraph> quotientBySymmetries( const DualGraph& dual );
@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool( int numThreads )
+{
+   for ( int i = 1; i < numThreads; i++ )
+      _Workers.push_back( std::thread( [this]() { workerLoop(); } ) );
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock( _Mutex );
+      _Quit = true;
+   }
+   _WakeWorkers.notify_all();
+   for ( std::thread& t : _Workers )
+      t.join();
+}
+
+void ThreadPool::runTasks()
+{
+   for ( int i = _NextTask++; i < _NumTasks; i = _NextTask++ )
+      (*_Func)( i );
+}
+
+void ThreadPool::workerLoop()
+{
+   uint64_t seenGeneration = 0;
+   while ( true )
+   {
+      {
+         std::unique_lock<std::mutex> lock( _Mutex );
+         _WakeWorkers.wait( lock, [&]() { return _Quit || _Generation != seenGeneration; } );
+         if ( _Quit )
+            return;
+         seenGeneration = _Generation;
+      }
+
+      runTasks();
+
+      {
+         std::lock_guard<std::mutex> lock( _Mutex );
+         if ( --_NumBusyWorkers == 0 )
+            _JobDone.notify_one();
+      }
+   }
+}
+
+void ThreadPool::run( int numTasks, const std::function<void(int)>& func )
+{
+   if ( _Workers.empty() || numTasks <= 1 )
+   {
+      for ( int i = 0; i < numTasks; i++ )
+         func( i );
+      return;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock( _Mutex );
+      _Func = &func;
+      _NumTasks = numTasks;
+      _NextTask = 0;
+      _NumBusyWorkers = (int) _Workers.size();
+      _Generation++;
+   }
+   _WakeWorkers.notify_all();
+
+   runTasks();
+
+   std::unique_lock<std::mutex> lock( _Mutex );
+   _JobDone.wait( lock, [&]() { return _NumBusyWorkers == 0; } );
+   _Func = nullptr;
+}
+
+void ThreadPool::parallelFor( int n, const std::function<void(int,int)>& func )
+{
+   int numRanges = std::max( 1, std::min( n, numThreads() ) );
+   run( numRanges, [&]( int i ) { func( (int) ( (int64_t) n * i / numRanges ), (int) ( (int64_t) n * (i+1) / numRanges ) ); } );
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "CoreMacros.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// fixed set of worker threads for fork/join loops
+// the calling thread takes part in `run`, so a pool of N threads starts N-1 workers
+class ThreadPool
+{
+public:
+   CORE_API ThreadPool( int numThreads );
+   CORE_API ~ThreadPool();
+   ThreadPool( const ThreadPool& ) = delete;
+   ThreadPool& operator=( const ThreadPool& ) = delete;
+
+   CORE_API int numThreads() const { return (int) _Workers.size() + 1; }
+
+   // calls `func( i )` for every i in [0,numTasks) and blocks until all calls have returned
+   CORE_API void run( int numTasks, const std::function<void(int)>& func );
+
+   // splits [0,n) into at most numThreads() contiguous ranges and calls `func( begin, end )` on each
+   CORE_API void parallelFor( int n, const std::function<void(int,int)>& func );
+
+private:
+   void workerLoop();
+   void runTasks();
+
+private:
+   std::vector<std::thread> _Workers;
+   std::mutex _Mutex;
+   std::condition_variable _WakeWorkers;
+   std::condition_variable _JobDone;
+   const std::function<void(int)>* _Func = nullptr;
+   int _NumTasks = 0;
+   std::atomic<int> _NextTask { 0 };
+   int _NumBusyWorkers = 0;
+   uint64_t _Generation = 0;
+   bool _Quit = false;
+};
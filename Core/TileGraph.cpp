@@ -1,6 +1,8 @@
 #include "TileGraph.h"
+#include "SpatialHash.h"
 
 #include <unordered_set>
+#include <set>
 
 std::vector<TileGraph::TilePtr> TileGraph::allTiles() const
 {   
@@ -13,22 +15,32 @@ std::vector<TileGraph::TilePtr> TileGraph::allTiles() const
 
 std::vector<TileGraph::VertexPtr> TileGraph::allVertices() const
 {   
-   std::unordered_set<int> usedIds;
+   std::unordered_set<int64_t> usedIds;
    std::vector<VertexPtr> ret;
-   for ( const TilePtr& tile : allTiles() )
-      for ( const VertexPtr& vtx : tile.vertices() )
-      {
-         if ( !usedIds.insert( vtx.id() ).second ) continue; // already used
-         ret.push_back( vtx );
-      }
+   for ( const Tile& tile : _Tiles )
+      for ( const SectorId& sector : tile._Symmetry->uniqueSectors() )
+         for ( const VertexPtr& vtx : tile.toTilePtr( this ).premul( sector ).vertexRange() )
+         {
+            if ( !usedIds.insert( vtx.id() ).second ) continue; // already used
+            ret.push_back( vtx );
+         }
    return ret;
 }
 
-TileGraph::VertexPtr TileGraph::vertexWithId( int id ) const
+TileGraph::VertexPtr TileGraph::vertexWithId( int64_t id ) const
 {
-   for ( const VertexPtr& a : allVertices() )
-      if ( a.id() == id )
-         return a;
+   int index, sectorId;
+   if ( !decodeId( id, idStride( (int) _Vertices.size() ), (int) _Vertices.size(), index, sectorId ) || !_GraphSymmetry->isSectorId( sectorId ) )
+      return VertexPtr();
+
+   VertexPtr ret( this, index, SectorId( sectorId, _GraphSymmetry.get() ) );
+   if ( ret.sectorId().id() != sectorId ) // not canonical
+      return VertexPtr();
+
+   // `allVertices` are the corners of the visible tiles
+   for ( const TilePtr& tile : ret.tileRange() )
+      if ( _GraphSymmetry->isSectorIdVisible( tile.sectorId().id() ) )
+         return ret;
    return VertexPtr();
 }
 
@@ -48,18 +60,9 @@ std::vector<TileGraph::TilePtr> TileGraph::rawTiles() const
    return ret;
 }
 
-std::vector<TileGraph::TilePtr> TileGraph::VertexPtr::tiles() const
-{
-   std::vector<TilePtr> ret;
-   for ( const TilePtr& tile : baseVertex()._Tiles )
-      ret.push_back( tile.premul( sectorId() ) );
-   return ret;
-}
-
 bool TileGraph::VertexPtr::hasTile( const TilePtr& tile ) const
 {
-   std::vector<TilePtr> ret;
-   for ( const TilePtr& a : tiles() )
+   for ( const TilePtr& a : tileRange() )
       if ( a == tile )
          return true;
    return false;
@@ -67,21 +70,12 @@ bool TileGraph::VertexPtr::hasTile( const TilePtr& tile ) const
 
 TileGraph::TilePtr TileGraph::VertexPtr::tileWithColor( int color ) const
 {
-   std::vector<TilePtr> ret;
-   for ( const TilePtr& tile : tiles() )
+   for ( const TilePtr& tile : tileRange() )
       if ( tile.color() == color )
          return tile;
    return TileGraph::TilePtr();
 }
 
-std::vector<TileGraph::VertexPtr> TileGraph::VertexPtr::neighbors() const
-{
-   std::vector<VertexPtr> ret;
-   for ( const VertexPtr& vtx : baseVertex()._Neighbors )
-      ret.push_back( vtx.premul( sectorId() ) );
-   return ret;
-}
-
 TileGraph::VertexPtr TileGraph::VertexPtr::calcCurve( const VertexPtr& b ) const
 {
    std::vector<TilePtr> tiles = _Graph->tilesAt( *this, b );
@@ -93,7 +87,7 @@ TileGraph::VertexPtr TileGraph::VertexPtr::calcCurve( const VertexPtr& b ) const
       int otherTileColor = tiles[1-tileIdx].color();
       if ( otherTileColor == BLANK_COLOR )
          continue;
-      for ( const VertexPtr& vtx : tiles[tileIdx].vertices() )
+      for ( const VertexPtr& vtx : tiles[tileIdx].vertexRange() )
       {
          if ( vtx == *this ) continue;
          if ( vtx == b ) continue;
@@ -107,7 +101,7 @@ TileGraph::VertexPtr TileGraph::VertexPtr::calcCurve( const VertexPtr& b ) const
 std::vector<TileGraph::TilePtr> TileGraph::tilesAt( const VertexPtr& a, const VertexPtr& b ) const
 {
    std::vector<TilePtr> ret;
-   for ( const TilePtr& tile : a.tiles() )
+   for ( const TilePtr& tile : a.tileRange() )
       if ( b.hasTile( tile ) )
          ret.push_back( tile );
    return ret;
@@ -123,9 +117,7 @@ namespace
       if ( depth <= 0 )
          return;
 
-      std::vector<TileGraph::VertexPtr> ret;
-
-      for ( const TileGraph::VertexPtr& neighb : vtx.neighbors() )
+      for ( const TileGraph::VertexPtr& neighb : vtx.neighborRange() )
          calcNeighbors( neighb, depth-1, st );
    }
 }
@@ -139,17 +131,9 @@ std::vector<TileGraph::VertexPtr> TileGraph::VertexPtr::neighbors( int depth ) c
 }
 
 
-std::vector<TileGraph::VertexPtr> TileGraph::TilePtr::vertices() const
-{
-   std::vector<VertexPtr> ret;
-   for ( const VertexPtr& a : baseTile()._Vertices )
-      ret.push_back( a.premul( _SectorId ) );
-   return ret;
-}
-
 bool TileGraph::VertexPtr::hasColor( int color ) const
 {
-   for ( const TilePtr& a : tiles() )
+   for ( const TilePtr& a : tileRange() )
       if ( a.color() == color )
          return true;
    return false;
@@ -158,9 +142,9 @@ bool TileGraph::VertexPtr::hasColor( int color ) const
 XYZ TileGraph::TilePtr::avgPos() const
 {
    XYZ sum;
-   for ( const VertexPtr& a : vertices() )
+   for ( const VertexPtr& a : vertexRange() )
       sum += a.pos();
-   return _Graph->_GraphShape->toSurfaceFrom3D( sum / vertices().size() );
+   return _Graph->_GraphShape->toSurfaceFrom3D( sum / vertexRange().size() );
 }
 
 
@@ -194,13 +178,13 @@ TileGraph::VertexPtr TileGraph::vertexAt( const XYZ& pos, double maxDist ) const
 
 void TileGraph::setVertexPos( const VertexPtr& vtx, const XYZ& pos )
 {
-   _Vertices[vtx.index()]._Pos = vtx.matrix().inverted() * pos;
+   _Vertices[vtx.index()]._Pos = vtx.sectorId().inverseTransform() * pos;
 }
 
 
 bool TileGraph::mustBeFar( const VertexPtr& a, const VertexPtr& b ) const
 {   
-   for ( const TilePtr& tileA : a.tiles() ) if ( tileA.color() != BLANK_COLOR )
+   for ( const TilePtr& tileA : a.tileRange() ) if ( tileA.color() != BLANK_COLOR )
    {
       TilePtr tileB = b.tileWithColor( tileA.color() );
       if ( tileB.isValid() && tileA != tileB )
@@ -211,7 +195,7 @@ bool TileGraph::mustBeFar( const VertexPtr& a, const VertexPtr& b ) const
 
 bool TileGraph::mustBeClose( const VertexPtr& a, const VertexPtr& b ) const
 {
-   for ( const TilePtr& tileA : a.tiles() )
+   for ( const TilePtr& tileA : a.tileRange() )
    {
       TilePtr tileB = b.tileWithColor( tileA.color() );
       if ( tileA == tileB )
@@ -229,8 +213,53 @@ std::vector<TileGraph::KeepCloseFar> TileGraph::calcKeepCloseFars() const
       for ( const VertexPtr& neighb : vtx.neighbors( 5/*search depth*/ ) )
       {
          KeepCloseFar kcf;
-         kcf.a = vtx;
-         kcf.b = neighb;
+         kcf.a = vtx.handle();
+         kcf.b = neighb.handle();
+         kcf.keepClose = mustBeClose( vtx, neighb );
+         kcf.keepFar = mustBeFar( vtx, neighb );
+         if ( kcf.keepClose || kcf.keepFar )
+            ret.push_back( kcf );
+      }
+   }
+   return ret;
+}
+
+std::vector<TileGraph::KeepCloseFar> TileGraph::calcKeepCloseFarsNear( double maxDist ) const
+{
+   // every instance of every vertex, not only the corners of the visible tiles, so that pairs reaching across the edge of the window are kept
+   std::unordered_set<int64_t> usedIds;
+   std::vector<VertexPtr> all;
+   std::vector<XYZ> allPos;
+   SpatialHash hash( maxDist );
+   for ( const SectorId& sector : _GraphSymmetry->allSectors() )
+      for ( const Vertex& a : _Vertices )
+      {
+         VertexPtr vtx = a.toVertexPtr( this ).premul( sector );
+         if ( !usedIds.insert( vtx.id() ).second ) continue; // already used
+         all.push_back( vtx );
+         allPos.push_back( vtx.pos() );
+         hash.insert( allPos.back(), (int)all.size() - 1 );
+      }
+
+   std::vector<KeepCloseFar> ret;
+   for ( const VertexPtr& vtx : rawVertices() )
+   {
+      std::set<VertexPtr> candidates;
+      for ( const TilePtr& tile : vtx.tileRange() )
+         for ( const VertexPtr& b : tile.vertexRange() )
+            candidates.insert( b );
+      XYZ p = vtx.pos();
+      hash.forEachNear( p, [&]( int i ) {
+         if ( allPos[i].dist2( p ) < maxDist * maxDist )
+            candidates.insert( all[i] );
+      } );
+      candidates.erase( vtx );
+
+      for ( const VertexPtr& neighb : candidates )
+      {
+         KeepCloseFar kcf;
+         kcf.a = vtx.handle();
+         kcf.b = neighb.handle();
          kcf.keepClose = mustBeClose( vtx, neighb );
          kcf.keepFar = mustBeFar( vtx, neighb );
          if ( kcf.keepClose || kcf.keepFar )
@@ -242,6 +271,8 @@ std::vector<TileGraph::KeepCloseFar> TileGraph::calcKeepCloseFars() const
 
 void TileGraph::normalizeVertices()
 {
-   for ( Vertex& a : _Vertices )
-      a._Pos = _GraphShape->toSurfaceFrom3D( a._Pos );
+   visitShape( *_GraphShape, [&]( const auto& shape ) {
+      for ( Vertex& a : _Vertices )
+         a._Pos = shape.toSurfaceFrom3D( a._Pos );
+   } );
 }
\ No newline at end of file
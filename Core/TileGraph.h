@@ -4,6 +4,7 @@
 #include "DataTypes.h"
 #include "Symmetry.h"
 #include "Defs.h"
+#include "SectorRange.h"
 
 #include <vector>
 #include <memory>
@@ -26,6 +27,7 @@ public:
       {
          _SectorId = symmetry()->canonicalizedSectorId( sectorId );
       }
+      VertexPtr( const TileGraph* graph, const GraphHandle& handle ) : _Graph(graph), _Index(handle.index), _SectorId(handle.sectorId, graph->_GraphSymmetry.get()) {} // `handle` is already canonical
       CORE_API bool isValid() const { return _Graph != nullptr; }
       CORE_API VertexPtr premul( const SectorId& sectorId ) const { return VertexPtr( _Graph, _Index, sectorId * _SectorId ); }
       CORE_API bool operator==( const VertexPtr& rhs ) const { return _Graph == rhs._Graph && _Index == rhs._Index && _SectorId == rhs._SectorId; }
@@ -35,15 +37,18 @@ public:
 
       CORE_API const Vertex& baseVertex() const { return _Graph->_Vertices[_Index]; }
       //CORE_API VertexPtr toVertexPtr( const TileGraph* graph ) const { return VertexPtr( graph, _Index, Matrix4x4() ); }
-      CORE_API XYZ pos() const { return matrix() * baseVertex()._Pos; }
-      CORE_API int id() const { return isValid() ? MAX_VERTICES * _SectorId.id() + _Index : -1; }
+      CORE_API XYZ pos() const { return _SectorId.transform() * baseVertex()._Pos; }
+      CORE_API int64_t id() const { return isValid() ? idStride( (int) _Graph->_Vertices.size() ) * _SectorId.id() + _Index : -1; }
+      CORE_API GraphHandle handle() const { return isValid() ? GraphHandle { _Index, _SectorId.id() } : GraphHandle(); }
       CORE_API std::string name() const { return std::to_string( id() ); }
       //CORE_API std::string name() const { return std::to_string( _Index ) + "-" + std::to_string( _SectorId ); }
       CORE_API Matrix4x4 matrix() const { return _Graph->_GraphSymmetry->matrix( _SectorId.id() ); }
       CORE_API int index() const { return _Index; }
-      CORE_API std::vector<TilePtr> tiles() const;
+      CORE_API std::vector<TilePtr> tiles() const { return tileRange().toVector(); }
+      SectorRange<TilePtr, TileGraph> tileRange() const { return SectorRange<TilePtr, TileGraph>( _Graph, _Graph->vertexTiles( _Index ), _Graph->vertexTiles( _Index+1 ), _SectorId ); }
       CORE_API TilePtr tileWithColor( int color ) const;
-      CORE_API std::vector<VertexPtr> neighbors() const;
+      CORE_API std::vector<VertexPtr> neighbors() const { return neighborRange().toVector(); }
+      SectorRange<VertexPtr, TileGraph> neighborRange() const { return SectorRange<VertexPtr, TileGraph>( _Graph, _Graph->vertexNeighbors( _Index ), _Graph->vertexNeighbors( _Index+1 ), _SectorId ); }
       CORE_API std::vector<VertexPtr> neighbors( int depth ) const;
       CORE_API VertexPtr calcCurve( const VertexPtr& b ) const;
       CORE_API bool hasTile( const TilePtr& tile ) const;
@@ -68,6 +73,7 @@ public:
       {
          _SectorId = baseTile()._Symmetry->canonicalizedSectorId( sectorId );
       }
+      TilePtr( const TileGraph* graph, const GraphHandle& handle ) : _Graph(graph), _Index(handle.index), _SectorId(handle.sectorId, graph->_GraphSymmetry.get()) {} // `handle` is already canonical
       CORE_API TilePtr premul( const SectorId& mtx ) const { return TilePtr( _Graph, _Index, mtx * _SectorId ); }
       CORE_API bool isValid() const { return _Graph != nullptr; }
       bool operator==( const TilePtr& rhs ) const { return id() == rhs.id(); }
@@ -75,14 +81,18 @@ public:
 
       CORE_API const Tile& baseTile() const { return _Graph->_Tiles[_Index]; }
       CORE_API int color() const { return _SectorId.mapColor( baseTile()._Color ); }
-      CORE_API std::vector<VertexPtr> vertices() const;
+      CORE_API std::vector<VertexPtr> vertices() const { return vertexRange().toVector(); }
+      SectorRange<VertexPtr, TileGraph> vertexRange() const { return SectorRange<VertexPtr, TileGraph>( _Graph, baseTile()._Vertices, _SectorId ); }
       CORE_API std::vector<std::pair<TileGraph::VertexPtr,TileGraph::VertexPtr>> edges() const { return toEdges( vertices() ); }
       CORE_API XYZ avgPos() const;
-      CORE_API int id() const { return isValid() ? MAX_VERTICES * _SectorId.id() + _Index : -1; }
+      CORE_API int64_t id() const { return isValid() ? idStride( (int) _Graph->_Tiles.size() ) * _SectorId.id() + _Index : -1; }
+      CORE_API GraphHandle handle() const { return isValid() ? GraphHandle { _Index, _SectorId.id() } : GraphHandle(); }
       //CORE_API std::string name() const { return std::to_string( id() ); }
       CORE_API std::string name() const { return std::to_string( _Index ) + "-" + std::to_string( _SectorId.id() ); }
-      CORE_API VertexPtr next( const VertexPtr& a ) const { return baseTile().next( a.premul( _SectorId.inverted() ) ).premul( _SectorId ); }
-      CORE_API VertexPtr prev( const VertexPtr& a ) const { return baseTile().prev( a.premul( _SectorId.inverted() ) ).premul( _SectorId ); }      
+      CORE_API VertexPtr corner( int i ) const { return VertexPtr( _Graph, baseTile().corner( i ) ).premul( _SectorId ); }
+      CORE_API SectorId sectorId() const { return _SectorId; }
+      CORE_API VertexPtr next( const VertexPtr& a ) const { return corner( baseTile().cornerOf( a.premul( _SectorId.inverted() ).handle() ) + 1 ); }
+      CORE_API VertexPtr prev( const VertexPtr& a ) const { return corner( baseTile().cornerOf( a.premul( _SectorId.inverted() ).handle() ) - 1 ); }
 
    private:
       const TileGraph* _Graph = nullptr;
@@ -102,8 +112,6 @@ public:
       int _Index;
       XYZ _Pos;
       bool _OnPerimeter = false;
-      std::vector<VertexPtr> _Neighbors;
-      std::vector<TilePtr> _Tiles;
       std::shared_ptr<SectorSymmetryForVertex> _Symmetry;
    };
    class Tile
@@ -111,22 +119,19 @@ public:
    public:
       TilePtr toTilePtr( const TileGraph* graph ) const { return TilePtr( graph, _Index, SectorId::identity( graph->_GraphSymmetry.get() ) ); }
 
-      VertexPtr next( const VertexPtr& a ) const { return _Vertices[mod(verticesIndexOf(a)+1, (int)_Vertices.size())]; }
-      VertexPtr prev( const VertexPtr& a ) const { return _Vertices[mod(verticesIndexOf(a)-1, (int)_Vertices.size())]; }
-
-   private:
-      int verticesIndexOf( const VertexPtr& a ) const { for ( int i = 0; i < (int) _Vertices.size(); i++ ) if ( _Vertices[i] == a ) return i; throw 777; return -1; }
+      GraphHandle corner( int i ) const { return _Vertices[mod( i, (int)_Vertices.size() )]; }
+      int cornerOf( const GraphHandle& a ) const { for ( int i = 0; i < (int) _Vertices.size(); i++ ) if ( _Vertices[i] == a ) return i; throw 777; return -1; }
 
    public:
       int _Index;
       int _Color;
-      std::vector<VertexPtr> _Vertices;
+      std::vector<GraphHandle> _Vertices;
       std::shared_ptr<SectorSymmetryForVertex> _Symmetry;
    };
    struct KeepCloseFar
    {
-      VertexPtr a;
-      VertexPtr b;
+      GraphHandle a;
+      GraphHandle b;
       bool keepClose;
       bool keepFar;
    };
@@ -148,21 +153,38 @@ public:
    CORE_API std::vector<VertexPtr> rawVertices() const;
    CORE_API std::vector<TilePtr> allTiles() const;
    CORE_API std::vector<VertexPtr> allVertices() const;
-   CORE_API VertexPtr vertexWithId( int id ) const;
+   CORE_API VertexPtr vertexWithId( int64_t id ) const; // one of `allVertices`, decoded from the id
+   CORE_API VertexPtr vertex( const GraphHandle& handle ) const { return VertexPtr( this, handle ); }
+   CORE_API TilePtr tile( const GraphHandle& handle ) const { return TilePtr( this, handle ); }
 
    CORE_API VertexPtr vertexAt( const XYZ& pos, double maxDist ) const;
    CORE_API void setVertexPos( const VertexPtr& vtx, const XYZ& pos );
 
    CORE_API std::vector<KeepCloseFar> calcKeepCloseFars() const;
+   // same, but the candidate pairs come from geometry instead of graph distance:
+   // every pair sharing a tile, plus every pair of instanced vertices (over all sectors) closer than `maxDist`
+   CORE_API std::vector<KeepCloseFar> calcKeepCloseFarsNear( double maxDist ) const;
    CORE_API bool mustBeClose( const VertexPtr& a, const VertexPtr& b ) const;
    CORE_API bool mustBeFar( const VertexPtr& a, const VertexPtr& b ) const;
    CORE_API void normalizeVertices();
 
    CORE_API std::vector<TilePtr> tilesAt( const VertexPtr& a, const VertexPtr& b ) const;
 
+   // start of vertex `index`'s adjacency;  index+1 gives the end
+   const GraphHandle* vertexNeighbors( int index ) const { return _VertexNeighbors.data() + _VertexNeighborStart[index]; }
+   const GraphHandle* vertexTiles( int index ) const { return _VertexTiles.data() + _VertexTileStart[index]; }
+
 public:
    std::vector<Vertex> _Vertices;
    std::vector<Tile> _Tiles;
+
+   // adjacency of all vertices, CSR:  vertex v's neighbors are _VertexNeighbors[_VertexNeighborStart[v] .. _VertexNeighborStart[v+1]),
+   // and likewise its tiles, with its position in each of them in `_VertexTileCorners` (so walking a tile boundary needs no search)
+   std::vector<int> _VertexNeighborStart;
+   std::vector<GraphHandle> _VertexNeighbors;
+   std::vector<int> _VertexTileStart;
+   std::vector<GraphHandle> _VertexTiles;
+   std::vector<int> _VertexTileCorners;
    std::shared_ptr<IGraphSymmetry> _GraphSymmetry;
    std::shared_ptr<IGraphShape> _GraphShape;
 };
@@ -7,7 +7,7 @@
 #include <Core/Simulation.h>
 #include <Core/DualAnalysis.h>
 
-#include <unordered_set>
+#include <set>
 
 
 namespace
@@ -16,9 +16,9 @@ namespace
    {
       painter.drawText( QRectF( p + QPointF( -1000, -1000 ), QSizeF( 2000, 2000 ) ), QString::fromStdString( str ), QTextOption( Qt::AlignCenter ) );
    }
-   uint64_t edgeId( const TileGraph::VertexPtr& a, const TileGraph::VertexPtr& b )
+   std::pair<int64_t,int64_t> edgeId( const TileGraph::VertexPtr& a, const TileGraph::VertexPtr& b )
    {
-      return ( (uint64_t) std::max( a.id(), b.id() ) << 32 ) + std::min( a.id(), b.id() );
+      return { std::max( a.id(), b.id() ), std::min( a.id(), b.id() ) };
    }
    std::vector<XYZ> calcCurvePlanar( const XYZ& p0_, const XYZ& p1_, const XYZ& center, double maxDistance, bool addP0 )
    {
@@ -278,16 +278,16 @@ QImage Drawing::makeTransparentImage( const QSize& size, std::shared_ptr<const S
       {
          painter.setPen( QPen( QColor(0,0,0,96), 2.5 ) );
          painter.setBrush( Qt::NoBrush );
-         std::unordered_set<uint64_t> usedEdges;
+         std::set<std::pair<int64_t,int64_t>> usedEdges;
          for ( const SectorId& sectorId : simulation->_TileGraph->_GraphSymmetry->allVisibleSectors() )
          for ( const auto& pr : simulation->_KeepCloseFars )
          {  
-            TileGraph::VertexPtr aa = pr.a.premul( sectorId );
-            TileGraph::VertexPtr bb = pr.b.premul( sectorId );
+            TileGraph::VertexPtr aa = simulation->_TileGraph->vertex( pr.a ).premul( sectorId );
+            TileGraph::VertexPtr bb = simulation->_TileGraph->vertex( pr.b ).premul( sectorId );
             if ( !usedEdges.insert( edgeId( aa, bb ) ).second )
                continue;
-            XYZ a = sectorId.matrix() * pr.a.pos();
-            XYZ b = sectorId.matrix() * pr.b.pos();
+            XYZ a = aa.pos();
+            XYZ b = bb.pos();
 
             {
                if ( pr.keepClose && pr.keepFar && isVisible( a ) && isVisible( b )  )
@@ -415,6 +415,6 @@ bool Drawing::getModelPos( const QPointF& bitmapPos, XYZ& modelPos ) const
    XYZ surfacePos;
    if ( !_GraphShape->toSurfaceFrom2D( _ModelToBitmap.inverted() * XYZ( bitmapPos.x(), bitmapPos.y(), 0. ), surfacePos ) )
       return false; 
-   modelPos = _ModelRotation.inverted() * surfacePos;
+   modelPos = RigidTransform( _ModelRotation ).inverted() * surfacePos;
    return true;
 }
\ No newline at end of file
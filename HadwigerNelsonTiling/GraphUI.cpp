@@ -6,6 +6,7 @@
 #include <Core/Util.h>
 #include <Core/Simulation.h>
 #include <Core/DualAnalysis.h>
+#include <Core/SymmetryDiscovery.h>
 
 #include <QShortcut>
 #include <QMouseEvent>
@@ -16,6 +17,8 @@
 #include <QJsonDocument>
 #include <QFileDialog>
 #include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QDir>
 
 namespace
 {
@@ -193,7 +196,13 @@ GraphUI::GraphUI( QWidget *parent )
    //SymmetryGroup g3( Matrix4x4::rotation( XYZ(0,0,1), 2*PI/3 ) * Matrix4x4::translation( XYZ(3,0,0) ), Perm( { 1,2,0,3,4,5,6,7,8,9 } ) );   
    //std::shared_ptr<IGraphSymmetry> sym( new GraphSymmetry_Groups( { g3, g5 } ) );
 
+   // opt-in:  sector tables of big symmetries are cached in a `symcache` directory next to the executable, if one was created
+   QString symmetryCacheDir = QCoreApplication::applicationDirPath() + "/symcache";
+   if ( QDir( symmetryCacheDir ).exists() )
+      GraphSymmetry_Groups::setCacheDirectory( symmetryCacheDir.toStdString() );
+
    _Simulation.reset( new Simulation );
+   _Simulation->setNumThreads( (int) std::thread::hardware_concurrency() );
 
    //loadGraph( hardcodedDualGraph( 3 ) );
    //loadGraph( loadDual( R"(C:\Users\Tom\Desktop\dual\temp.dual)" ) );
@@ -243,16 +252,29 @@ GraphUI::GraphUI( QWidget *parent )
       int simSteps = 50;
       QElapsedTimer t;
       t.start();
-      double error = _Simulation->step( simSteps );
+      double error;
+      double paddingError;
+      if ( _Simulation->_AdaptiveStep ) // run to convergence within the frame's time budget
+      {
+         Simulation::RunResult result = _Simulation->runUntil( 1e-12/*tolerance*/, 1000000, .03/*seconds*/ );
+         error = result.error;
+         paddingError = result.paddingError;
+         simSteps = result.numSteps;
+      }
+      else
+      {
+         error = _Simulation->step( simSteps );
+         paddingError = _Simulation->_PaddingError;
+      }
       double time = t.nsecsElapsed() * 1e-9;
       ui.errorLabel->setText( "Err:" + QString::number( error ) );
-      ui.paddingErrorLabel->setText( "Pad:" + QString::number( _Simulation->_PaddingError ) );      
+      ui.paddingErrorLabel->setText( "Pad:" + QString::number( paddingError ) );      
       //ui.speedLabel->setText( "Speed(ms): " + QString::number( 1000*time/simSteps ) );
       updateDrawing();
    } );
 
    connect( ui.dualToTileButton, &QPushButton::clicked, [&](){  
-      _Simulation->_TileGraph = makeTileGraph( *_Simulation->_DualGraph, 1. );
+      _Simulation->_TileGraph = makeTileGraph( *_Simulation->_DualGraph );
       _Simulation->init( _Simulation->_TileGraph );
       updateDrawing();
    } );
@@ -347,6 +369,12 @@ GraphUI::GraphUI( QWidget *parent )
 
    QObject::connect( new QShortcut(QKeySequence(Qt::Key_Delete), this ), &QShortcut::activated, [this]() { deleteVertex(); } );
 
+   // Play with the adaptive step size, running each frame until converged, instead of 50 fixed steps
+   QObject::connect( new QShortcut(QKeySequence(Qt::Key_A), this ), &QShortcut::activated, [this]() { _Simulation->_AdaptiveStep = !_Simulation->_AdaptiveStep; } );
+
+   // rebuild the graph over the fundamental domain of all the rotations and reflections it has (nothing if it has no more than its symmetry)
+   QObject::connect( new QShortcut(QKeySequence(Qt::Key_Q), this ), &QShortcut::activated, [this]() { if ( _Simulation->_DualGraph ) loadGraph( quotientBySymmetries( *_Simulation->_DualGraph ) ); } );
+
 }
 
 GraphUI::~GraphUI()